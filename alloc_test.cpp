@@ -0,0 +1,168 @@
+// Checks that warmed up frames make no heap allocations, exits nonzero on
+// the first frame that does:
+//
+//     clang++ -O1 alloc_test.cpp -pthread && ./a.out
+//
+// Frames run through Runner::runFrame and create and destroy entities,
+// serially and with createEntityConcurrent from parallel tasks, without
+// growing the world, besides parallelIterate, parallelReduce and minirun.
+// It runs on the thread pool, whose tasks and barriers don't allocate.
+
+#define CZSS_BACKEND_THREAD_POOL
+#define CZSS_ALLOC_COUNTERS
+#define CZSS_IMPLEMENTATION
+#include "czss.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace czss;
+
+static constexpr uint64_t PARTICLES = 100000;
+static constexpr uint64_t CHURN = 64;
+// One spark per this many particles each frame
+static constexpr uint64_t SPARK_EVERY = 512;
+static constexpr uint64_t TASKS = 8;
+static constexpr int WARMUP_FRAMES = 50;
+static constexpr int FRAMES = 200;
+
+struct Position : Component<Position>
+{
+	float x = 0.0f;
+};
+
+struct Heat : Component<Heat>
+{
+	float value = 0.0f;
+};
+
+struct Particle : Entity<Position> {};
+struct Spark : Entity<Heat> {};
+
+struct Ring : Resource<Ring>
+{
+	Guid guids[PARTICLES];
+	uint64_t head = 0;
+};
+
+struct TestArch : Architecture<
+	TestArch,
+	Ring,
+	Particle,
+	Spark
+> {};
+
+// Replaces the oldest particles with new ones
+struct Churn : System<Orchestrator<Particle>, Writer<Ring>>
+{
+	static void run(Accessor<TestArch, Churn>& arch)
+	{
+		Ring* ring = arch.getResource<Ring>();
+		for (uint64_t i = 0; i < CHURN; i++)
+		{
+			Guid& guid = ring->guids[ring->head++ % PARTICLES];
+			arch.destroyEntity(guid);
+			guid = arch.createEntity<Particle>()->getGuid();
+		}
+	}
+};
+
+struct Move : System<Writer<Position>, Dependency<Churn>>
+{
+	static void run(Accessor<TestArch, Move>& arch)
+	{
+		arch.parallelIterate<Iterator<Position>>(TASKS, [] (uint64_t, auto& e) {
+			e.template getComponent<Position>()->x += 1.0f;
+		});
+	}
+};
+
+// Replaces last frame's sparks with new ones created from parallel tasks
+struct Sparks : System<Orchestrator<Spark>, Reader<Position>, Dependency<Move>>
+{
+	static void run(Accessor<TestArch, Sparks>& arch)
+	{
+		arch.destroyEntities<Spark>();
+		arch.parallelIterate<Iterator<Position>>(TASKS, [&] (uint64_t, auto& e) {
+			if (e.getGuid().get() % SPARK_EVERY == 0)
+				arch.template createEntityConcurrent<Spark>()->template getComponent<Heat>()->value = 1.0f;
+		});
+	}
+};
+
+struct Measure : System<Reader<Position, Heat>, Dependency<Sparks>>
+{
+	static void run(Accessor<TestArch, Measure>& arch)
+	{
+		volatile float sum = arch.parallelReduce<Iterator<Position>>(TASKS, 0.0f,
+			[] (auto& e) { return e.template viewComponent<Position>()->x; },
+			[] (float a, float b) { return a + b; });
+		(void)sum;
+	}
+};
+
+CZSS_NAME(Churn, "Churn")
+CZSS_NAME(Move, "Move")
+CZSS_NAME(Sparks, "Sparks")
+CZSS_NAME(Measure, "Measure")
+
+using TestRunner = Runner<TestArch, std::tuple<Churn, Move, Sparks, Measure>>;
+
+static void miniMove(Accessor<TestArch, Move>& arch)
+{
+	arch.parallelIterate<Iterator<Position>>(TASKS, [] (uint64_t, auto& e) {
+		e.template getComponent<Position>()->x -= 1.0f;
+	});
+}
+
+static void miniMeasure(Accessor<TestArch, Measure>& arch)
+{
+	volatile uint64_t n = arch.countCompatibleEntities<Iterator<Heat>>();
+	(void)n;
+}
+
+int main()
+{
+	ThreadPool::start(4);
+
+	auto arch = std::make_unique<TestArch>();
+	auto ring = std::make_unique<Ring>();
+	arch->setResource(ring.get());
+
+	auto accessor = arch->accessor();
+	for (uint64_t i = 0; i < PARTICLES; i++)
+		ring->guids[i] = accessor.createEntity<Particle>()->getGuid();
+
+	TestRunner::FrameClock clock;
+	TestRunner::FrameStats stats;
+	for (int frame = -WARMUP_FRAMES; frame < FRAMES; frame++)
+	{
+		TestRunner::runFrame(arch.get(), &clock, 0.016, &stats);
+
+		uint64_t before = AllocCounters::total();
+		accessor.minirun(miniMove, miniMeasure);
+		uint64_t miniAllocations = AllocCounters::total() - before;
+
+		if (frame < 0)
+			continue;
+
+		if (stats.allocations != 0 || miniAllocations != 0)
+		{
+			fprintf(stderr, "FAIL: frame %d made %llu allocations in runFrame and %llu in minirun\n%s", frame,
+				static_cast<unsigned long long>(stats.allocations), static_cast<unsigned long long>(miniAllocations),
+				AllocCounters::report().c_str());
+			return 1;
+		}
+	}
+
+	uint64_t sparks = accessor.countCompatibleEntities<Iterator<Heat>>();
+	if (sparks == 0)
+	{
+		fprintf(stderr, "FAIL: no sparks were created\n");
+		return 1;
+	}
+
+	printf("alloc_test: %d frames without allocations, %llu sparks a frame\n", FRAMES,
+		static_cast<unsigned long long>(sparks));
+	ThreadPool::stop();
+}
@@ -0,0 +1,131 @@
+#ifndef CZSS_BENCH_HARNESS_H
+#define CZSS_BENCH_HARNESS_H
+
+// What benchmark.cpp and scaling.cpp share: starting the backend at each
+// worker count, parsing options and writing JSON. Include it after czss.hpp
+// and, for czsf, after czsf.h with their implementations.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace bench
+{
+
+volatile static bool EXITING = false;
+static uint32_t currentThreads = 1;
+static void (*currentBody)() = nullptr;
+
+static const char* backendName()
+{
+#if defined(CZSS_BACKEND_THREAD_POOL)
+	return "thread_pool";
+#elif defined(CZSF_IMPL_THREADS)
+	return "czsf_threads";
+#else
+	return "czsf_fibers";
+#endif
+}
+
+static void runBody()
+{
+	currentBody();
+	EXITING = true;
+}
+
+// Runs body once on a backend of the given number of workers. Under
+// CZSF_IMPL_THREADS czsf starts a thread per task and workers only sets
+// currentThreads.
+static void runWithWorkers(uint32_t workers, void (*body)())
+{
+	currentThreads = workers;
+	currentBody = body;
+	EXITING = false;
+
+#if defined(CZSS_BACKEND_THREAD_POOL)
+	czss::ThreadPool::stop();
+	czss::ThreadPool::start(workers);
+	runBody();
+#elif defined(CZSF_IMPL_THREADS)
+	runBody();
+#else
+	czsf::run(runBody);
+
+	std::vector<std::thread> threads(workers);
+	for (auto& thread : threads)
+		thread = std::thread([] { czss::CzsfBackend::work(EXITING); });
+
+	for (auto& thread : threads)
+		thread.join();
+#endif
+}
+
+// Runs body at 1, 2, 4... workers up to maxThreads, and at maxThreads when
+// it isn't a power of two.
+static void runScaling(uint32_t maxThreads, void (*body)())
+{
+	for (uint32_t workers = 1; workers <= maxThreads; workers *= 2)
+		runWithWorkers(workers, body);
+	if ((maxThreads & (maxThreads - 1)) != 0)
+		runWithWorkers(maxThreads, body);
+}
+
+// Calls f(name, value) for each "--name value" pair, which returns false
+// for options it doesn't know.
+template <typename F>
+static bool parseOptions(int argc, char** argv, F f)
+{
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!f(argv[i], argv[i + 1]))
+		{
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+static uint32_t defaultThreads()
+{
+	return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+// Writes a JSON object to path, or stdout without one, starting with the
+// backend and hardware concurrency. fields(f) writes the remaining fields,
+// each ending in a comma, and row(f, i) the fields of the ith of count
+// results.
+template <typename Fields, typename Row>
+static bool writeJson(const char* path, size_t count, Fields fields, Row row)
+{
+	FILE* f = path != nullptr ? fopen(path, "w") : stdout;
+	if (f == nullptr)
+	{
+		fprintf(stderr, "Can't open %s\n", path);
+		return false;
+	}
+
+	fprintf(f, "{\n\t\"backend\": \"%s\",\n\t\"hardware_concurrency\": %u,\n",
+		backendName(), std::thread::hardware_concurrency());
+	fields(f);
+	fprintf(f, "\t\"results\": [");
+
+	for (size_t i = 0; i < count; i++)
+	{
+		fprintf(f, "%s\n\t\t{ ", i == 0 ? "" : ",");
+		row(f, i);
+		fprintf(f, " }");
+	}
+
+	fprintf(f, "\n\t]\n}\n");
+	if (f != stdout)
+		fclose(f);
+	return true;
+}
+
+} // namespace bench
+
+#endif
@@ -0,0 +1,243 @@
+// Measures each operation on its own across entity and worker counts and
+// writes the results as JSON.
+//
+//     benchmark [--max-entities N] [--max-threads N] [--min-time SECONDS] [--out FILE]
+//
+// Entity counts go from 1e3 up to --max-entities (1e7) in powers of ten and
+// worker counts double from 1 up to --max-threads (hardware concurrency).
+// Under CZSF_IMPL_THREADS czsf starts a thread per task, so only one worker
+// count is measured.
+
+// #define CZSF_IMPL_THREADS
+#define CZSS_IMPLEMENTATION
+#include "czss.hpp"
+
+#ifndef CZSS_BACKEND_THREAD_POOL
+#define CZSF_IMPLEMENTATION
+#include <czsf.h>
+#endif
+
+#include "bench_harness.hpp"
+
+#include <memory>
+#include <random>
+
+using namespace czss;
+using bench::currentThreads;
+
+struct A : Component<A>
+{
+	uint64_t value;
+};
+
+struct Iter : Iterator<A> {};
+
+struct Ent : Entity<A> {};
+
+struct BenchArch : Architecture<
+	BenchArch,
+	Ent
+> {};
+
+struct Sysa : System<Writer<A>> { static void run(Accessor<BenchArch, Sysa>&) { } };
+struct Sysb : System<Reader<A>, Dependency<Sysa>> { static void run(Accessor<BenchArch, Sysb>&) { } };
+struct Sysc : System<Reader<A>> { static void run(Accessor<BenchArch, Sysc>&) { } };
+
+using BenchRunner = Runner<BenchArch, std::tuple<Sysa, Sysb, Sysc>>;
+
+static void mini_a(Accessor<BenchArch, Sysa>&) { }
+static void mini_b(Accessor<BenchArch, Sysb>&) { }
+static void mini_c(Accessor<BenchArch, Sysc>&) { }
+
+struct Options
+{
+	uint64_t maxEntities = 10000000;
+	uint32_t maxThreads = 0;
+	double minTime = 0.2;
+	const char* out = nullptr;
+};
+
+struct Result
+{
+	const char* op;
+	uint64_t entities;
+	uint32_t threads;
+	uint64_t repeats;
+	double min;
+	double median;
+	double mean;
+};
+
+static Options options;
+static std::vector<Result> results;
+
+// Sink for sums so the loops aren't optimized away
+static volatile uint64_t sink = 0;
+
+// Runs setup untimed and then fn timed until minTime has passed and at
+// least three samples were taken. Timings are per operation, a sample
+// being count operations.
+template <typename Setup, typename F>
+static void measure(const char* op, uint64_t entities, uint64_t count, Setup setup, F fn)
+{
+	std::vector<uint64_t> samples;
+	uint64_t total = 0;
+	while (samples.size() < 3 || (total < options.minTime * 1e9 && samples.size() < 1000))
+	{
+		setup();
+		uint64_t start = nanoTime();
+		fn();
+		uint64_t time = nanoTime() - start;
+		samples.push_back(time);
+		total += time;
+	}
+
+	std::sort(samples.begin(), samples.end());
+	Result r;
+	r.op = op;
+	r.entities = entities;
+	r.threads = currentThreads;
+	r.repeats = samples.size() * count;
+	r.min = double(samples.front()) / count;
+	r.median = double(samples[samples.size() / 2]) / count;
+	r.mean = double(total) / (samples.size() * count);
+	results.push_back(r);
+
+	fprintf(stderr, "%-16s entities %9llu threads %3u  median %12.3f ns\n", op,
+		static_cast<unsigned long long>(entities), currentThreads, r.median);
+}
+
+static void populate(BenchArch* arch, uint64_t n, std::vector<Guid>* guids = nullptr)
+{
+	auto accessor = arch->accessor();
+	for (uint64_t i = 0; i < n; i++)
+	{
+		Ent* e = accessor.createEntity<Ent>();
+		e->getComponent<A>()->value = i;
+		if (guids != nullptr)
+			guids->push_back(e->getGuid());
+	}
+}
+
+static void benchEntities(uint64_t n)
+{
+	std::unique_ptr<BenchArch> arch;
+	std::vector<Guid> guids;
+
+	if (currentThreads == 1)
+	{
+		measure("create", n, n,
+			[&] { arch = std::make_unique<BenchArch>(); },
+			[&] { populate(arch.get(), n); });
+
+		measure("destroy", n, n,
+			[&] { arch = std::make_unique<BenchArch>(); guids.clear(); populate(arch.get(), n, &guids); },
+			[&] {
+				auto accessor = arch->accessor();
+				for (Guid guid : guids)
+					accessor.destroyEntity(guid);
+			});
+	}
+
+	arch = std::make_unique<BenchArch>();
+	guids.clear();
+	populate(arch.get(), n, &guids);
+	std::shuffle(guids.begin(), guids.end(), std::mt19937_64(548739));
+	auto accessor = arch->accessor();
+
+	if (currentThreads == 1)
+	{
+		measure("guid_lookup", n, n, [] { }, [&] {
+			uint64_t sum = 0;
+			for (Guid guid : guids)
+				sum += accessor.getEntity<Ent>(guid)->getComponent<A>()->value;
+			sink = sum;
+		});
+
+		measure("iterate", n, n, [] { }, [&] {
+			uint64_t sum = 0;
+			accessor.iterate<Iter>([&] (auto& e) {
+				sum += e.template viewComponent<A>()->value;
+			});
+			sink = sum;
+		});
+
+		measure("range_for", n, n, [] { }, [&] {
+			uint64_t sum = 0;
+			for (auto& e : accessor.iterate<Iter>())
+				sum += e.template viewComponent<A>()->value;
+			sink = sum;
+		});
+	}
+
+	measure("parallel_iterate", n, n, [] { }, [&] {
+		accessor.parallelIterate<Iter>(currentThreads, [] (uint64_t, auto& e) {
+			e.template getComponent<A>()->value++;
+		});
+	});
+}
+
+static void benchOverhead()
+{
+	static constexpr uint64_t CALLS = 1000;
+	BenchArch arch;
+	auto accessor = arch.accessor();
+
+	measure("minirun", 0, CALLS, [] { }, [&] {
+		for (uint64_t i = 0; i < CALLS; i++)
+			accessor.minirun(mini_a, mini_b, mini_c);
+	});
+
+	measure("run_for_systems", 0, CALLS, [] { }, [&] {
+		for (uint64_t i = 0; i < CALLS; i++)
+			BenchRunner::runForSystems(&arch, BenchRunner::systemCallback, (int*)nullptr);
+	});
+}
+
+static void runBenchmarks()
+{
+	benchOverhead();
+	for (uint64_t n = 1000; n <= options.maxEntities; n *= 10)
+		benchEntities(n);
+}
+
+int main(int argc, char** argv)
+{
+	bool parsed = bench::parseOptions(argc, argv, [] (const char* name, const char* value) {
+		if (strcmp(name, "--max-entities") == 0)
+			options.maxEntities = uint64_t(atof(value));
+		else if (strcmp(name, "--max-threads") == 0)
+			options.maxThreads = uint32_t(atoi(value));
+		else if (strcmp(name, "--min-time") == 0)
+			options.minTime = atof(value);
+		else if (strcmp(name, "--out") == 0)
+			options.out = value;
+		else
+			return false;
+		return true;
+	});
+	if (!parsed)
+		return 1;
+
+	if (options.maxThreads == 0)
+		options.maxThreads = bench::defaultThreads();
+
+#ifdef CZSF_IMPL_THREADS
+	bench::runWithWorkers(1, runBenchmarks);
+#else
+	bench::runScaling(options.maxThreads, runBenchmarks);
+#endif
+
+	bool written = bench::writeJson(options.out, results.size(),
+		[] (FILE* f) {
+			fprintf(f, "\t\"simd\": \"%s\",\n", simd::isaName(simd::isa()));
+		},
+		[] (FILE* f, size_t i) {
+			const Result& r = results[i];
+			fprintf(f, "\"op\": \"%s\", \"entities\": %llu, \"threads\": %u, \"repeats\": %llu, "
+				"\"min_ns\": %.3f, \"median_ns\": %.3f, \"mean_ns\": %.3f",
+				r.op, static_cast<unsigned long long>(r.entities), r.threads,
+				static_cast<unsigned long long>(r.repeats), r.min, r.median, r.mean);
+		});
+	return written ? 0 : 1;
+}
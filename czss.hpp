@@ -3,19 +3,39 @@
 
 #include <tuple_utils.hpp>
 
-#ifndef CZSF_HEADERS_H
+#if !defined(CZSS_BACKEND_THREAD_POOL) && !defined(CZSF_HEADERS_H)
 #include <czsf.h>
 #endif
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cmath>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <queue>
+#include <span>
 #include <string>
 #include <type_traits>
 #include <unordered_map>
 #include <vector>
 #include <functional>
+#include <limits>
+#include <memory>
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define CZSS_COROUTINES
+#include <coroutine>
+#endif
 
 /* Timing functions
 	#define CZSS_TIMING_BEGIN timing_begin_function
@@ -29,6 +49,54 @@
 	Timing functions are called before and after system::run.
 */
 
+/* Profiler
+	#define CZSS_PROFILER
+
+	records systems, parallelIterate tasks and minirun entries into a ring
+	buffer per thread. czss::Profiler::writeChromeTrace(path) dumps them as
+	Chrome trace events, which Perfetto and chrome://tracing open. Code can
+	add its own scopes with CZSS_PROFILE_SCOPE(name, category). Under czsf a
+	system can suspend and let other fibers run on its thread, so system
+	spans are async events there, on a track per system, and minirun
+	entries on a track per call, rather than nested in the thread's. Without the define the scopes compile to
+	nothing.
+*/
+
+/* Performance counters
+	#define CZSS_PERF_COUNTERS
+
+	counts cycles, instructions, last level cache misses and branch misses
+	around each system run by Runner and each of its parallelIterate tasks,
+	through perf_event_open on Linux. czss::PerfCounters::of<Arch, System>()
+	holds the totals of a system and PerfCounters::report() lists them all.
+	Counters the kernel or the machine doesn't provide read as zero.
+	Counting pauses while a system waits on a czss barrier, so other tasks
+	or fibers run on its thread meanwhile aren't included. Waits on czsf
+	primitives used directly aren't paused.
+*/
+
+/* Allocation counters
+	#define CZSS_ALLOC_COUNTERS
+
+	replaces the global operator new and delete to count heap allocations
+	per system, through czss::AllocCounters::of<Arch, System>() and
+	AllocCounters::report(), and per frame in Runner::FrameStats. Once the
+	stores have grown to hold the world, a frame allocates only in what the
+	systems themselves do: task arrays come from reused Scratch blocks and
+	non-virtual stores create and destroy entities without allocating.
+	Memory from malloc, such as the tiers of a store, isn't counted.
+*/
+
+/* Task backend
+	Systems, minirun and parallelIterate run their tasks through
+	czss::Backend, which is czsf by default.
+
+	#define CZSS_BACKEND_THREAD_POOL
+
+	switches to czss::ThreadPool, a std::thread work-stealing pool that
+	starts its own workers, so czsf and its worker threads aren't needed.
+*/
+
 namespace czss
 {
 
@@ -132,6 +200,12 @@ void oncePerPair(Params&&... params)
 struct ThreadSafe {};
 struct Virtual {};
 
+// Components tagged Buffered keep a committed copy next to the live one.
+// Systems that only read a Buffered component see the copy made by the last
+// commitBuffers() and don't conflict with systems writing the live copy.
+// runForSystems and runFrame commit at the end of each frame.
+struct Buffered {};
+
 struct ComponentBase {};
 struct IteratorBase {};
 struct EntityBase {};
@@ -185,6 +259,30 @@ constexpr bool isComponent()
 	return isBaseType<ComponentBase, T>();
 }
 
+template<typename T>
+constexpr bool isBuffered()
+{
+	return isBaseType<ComponentBase, T>() && std::is_base_of<Buffered, T>::value;
+}
+
+struct BufferedFilter
+{
+	template <typename T>
+	static constexpr bool test()
+	{
+		return isBuffered<T>();
+	}
+};
+
+struct VirtualFilter
+{
+	template <typename T>
+	static constexpr bool test()
+	{
+		return isVirtual<T>();
+	}
+};
+
 template<typename T>
 constexpr bool isIterator()
 {
@@ -361,2366 +459,6888 @@ constexpr size_t numUniques()
 }
 
 // #####################
-// Data Rbox
+// Task backends
 // #####################
 
-struct Guid
+// Cpus and NUMA nodes of the machine. On Linux nodes are read from
+// /sys/devices/system/node, elsewhere every cpu is on node 0.
+struct Topology
 {
-	Guid(const Guid& guid);
-	Guid();
-	Guid(uint64_t id);
-	uint64_t get() const;
-	bool operator ==(const Guid& other) const;
-	bool operator !=(const Guid& other) const;
-	bool operator <(const Guid& other) const;
-private:
-	uint64_t id;
-};
+	// Cpu ids ordered by node, then by id
+	std::vector<uint32_t> cpus;
+	// Node of each cpu, indexed by cpu id
+	std::vector<uint32_t> cpuNodes;
+	uint32_t nodes = 1;
 
-template <typename E>
-struct EntityStore
-{
-	using type = EntityStore<E>;
+	uint32_t nodeOf(uint32_t cpu) const;
 
-	EntityStore()
-	{
-		CZSS_CONST_IF (!isVirtual<E>())
-			expand();
-	}
+	static const Topology& get();
+};
 
-	E* get(uint64_t id)
-	{
-		auto res = used_indices_map.find(id);
-		if (res == used_indices_map.end())
-			return nullptr;
-		return used_indices[res->second];
-	}
+// Pins the calling thread to a cpu, returns false if that isn't supported.
+// Czsf worker threads can call this before CzsfBackend::work.
+bool pinThread(uint32_t cpu);
 
-private:
-	static constexpr size_t BASE_POWER = 5;
+// Node of the cpu the calling thread is running on.
+uint32_t currentNode();
 
-	struct Index
-	{
-		bool operator< (const Index& other) const
-		{
-			return tier == other.tier ? index < other.index : tier < other.tier;
-		}
+// Nanoseconds on the steady clock
+inline uint64_t nanoTime()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-		size_t tier;
-		size_t index;
+#ifndef CZSS_BACKEND_THREAD_POOL
+struct CzsfBackend
+{
+#ifdef CZSS_PERF_COUNTERS
+	// Pauses the PerfScopes of the waiting fiber while other fibers run on
+	// its thread.
+	struct Barrier : czsf::Barrier
+	{
+		using czsf::Barrier::Barrier;
+		void wait();
 	};
+#else
+	using Barrier = czsf::Barrier;
+#endif
 
-	E* get(const Index& index)
+	template <typename T>
+	static void run(void (*fn)(T*), T* data, uint64_t count, Barrier* barrier)
 	{
-		return &entities[index.tier][index.index];
+		czsf::run(fn, data, count, barrier);
+		wake();
 	}
 
-	inline size_t indexToActiveI(const Index& index) const
+	template <typename F, typename T>
+	static void run(F* fls, void (*fn)(T*), T* data, uint64_t count, Barrier* barrier)
 	{
-		// The arrays are powers of two in size so offset is calculated
-		// by setting all bits preceding the power of the current tier
-		// to 1 and masking off the section that is below base power
-		// i.e. arrays that don't exist.
-		// e.g. BASE_POWER = 2, index.tier = 1
-		// 00000010 2
-		// 00010000 bit shift
-		// 00001111 subtract
-		// 00001000 and
-		static constexpr size_t maskL = ~size_t(0) << (BASE_POWER + 1);
-		size_t offset = ((2 << (index.tier + BASE_POWER)) - 1) & maskL;
-		return offset + index.index;
+		czsf::run(fls, fn, data, count, barrier);
+		wake();
 	}
 
-public:
-	inline bool isActive(const size_t& i) const
+	// Fibers move between worker threads, so memory isn't placed on nodes
+	// and node hints are ignored.
+	template <typename T>
+	static void runOnNodes(void (*fn)(T*), T* data, uint64_t count, Barrier* barrier, const uint32_t* nodes)
 	{
-		size_t mod = i % (sizeof(size_t) * 8);
-		return active[i / (sizeof(size_t) * 8)] & (1 << mod);
+		run(fn, data, count, barrier);
 	}
 
-	inline void setActive(const size_t& i, const bool& value)
-	{
-		size_t mod = i % (sizeof(size_t) * 8);
-		if (value)
-			active[i / (sizeof(size_t) * 8)] |= (1 << mod);
-		else
-			active[i / (sizeof(size_t) * 8)] &= ~(1 << mod);
-	}
+	static uint32_t numaNodes() { return 1; }
+	static void touchOnNode(void* p, size_t bytes, uint32_t node) { }
 
-	inline bool isActive(const Index& index) const
-	{
-		return isActive(indexToActiveI(index));
-	}
+	// Czsf doesn't tell when its workers are out of tasks, so no worker
+	// idle time is reported.
+	static uint32_t workerCount() { return 0; }
+	static uint64_t idleTime(uint32_t worker) { return 0; }
 
-	inline void setActive(const Index& index, const bool& value)
-	{
-		setActive(indexToActiveI(index), value);
-	}
+	// Workers don't park while any activity is in flight. Runner, minirun
+	// and parallelIterate mark their duration as activity.
+	static void beginActivity();
+	static void endActivity();
 
-	template <typename T, typename ...Params>
-	T* create(uint64_t& id, Params&&... params)
+	struct Activity
 	{
-		id = nextId++;
+		Activity() { beginActivity(); }
+		~Activity() { endActivity(); }
+	};
 
-		T* res;
-		auto used_indices_index = used_indices.size();
+	// Worker thread loop, runs czsf tasks until exiting is set:
+	//
+	//	std::thread([] { czss::CzsfBackend::work(EXITING); });
+	//
+	// A worker that finds no work for spinCount yields while no activity
+	// is in flight parks until a task is submitted, an activity begins or
+	// parkTimeout passes. The timeout bounds the delay of tasks czss
+	// doesn't know about, such as those from czsf::run called directly.
+	static void work(const volatile bool& exiting);
 
-		CZSS_CONST_IF (isVirtual<T>())
-		{
-			res = new T(std::forward<Params>(params)...);
-		}
-		else
-		{
-			if(free_indices.size() == 0)
-				expand();
+	static uint32_t spinCount;
+	static std::chrono::microseconds parkTimeout;
 
-			auto index = free_indices.top();
-			free_indices.pop();
-			res = get(index);
-			new(res) T(std::forward<Params>(params)...);
-			index_map.insert({id, index});
-		}
+private:
+	struct State;
+	static State& state();
+	static void wake();
+};
+#endif
 
-		used_indices.push_back(res);
-		used_indices_map.insert({id, used_indices_index});
-		used_indices_map_reverse.insert({used_indices_index, id});
+// Work-stealing pool of std::threads. Each worker owns a task queue, pops
+// its newest task and steals the oldest ones of other workers when empty.
+// Tasks submitted from outside the pool go to a shared queue. A worker
+// blocking on a Barrier wakes or starts another worker so the pool keeps
+// its configured parallelism while tasks wait on each other.
+struct ThreadPool
+{
+	struct Barrier
+	{
+		Barrier() : value(0) { }
+		Barrier(int64_t value) : value(value) { }
 
-		return res;
-	}
+		Barrier(const Barrier&) = delete;
+		Barrier& operator=(const Barrier&) = delete;
 
-	void destroy(uint64_t id)
-	{
-		CZSS_CONST_IF (isVirtual<E>())
+		void setValue(int64_t value)
 		{
-			auto res = used_indices_map.find(id);
-			if (res == used_indices_map.end())
-				return;
-
-			delete(used_indices[res->second]);
+			this->value.store(value, std::memory_order_release);
 		}
-		else
-		{
-			auto res = index_map.find(id);
-			if (res == index_map.end())
-				return;
 
-			auto index = res->second;
-			auto p = get(index);
-			p->~E();
-			memset(reinterpret_cast<void*>(p), 0, sizeof(E));
-			free_indices.push(index);
-			index_map.erase(id);
+		void signal()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (value.fetch_sub(1, std::memory_order_acq_rel) <= 1)
+				cv.notify_all();
 		}
 
-		auto ui_index = used_indices_map[id];
+		void wait();
 
-		auto replace_index = used_indices.size() - 1;
-		used_indices[ui_index] = used_indices[replace_index];
-		auto replace_id = used_indices_map_reverse[replace_index];
-
-		used_indices_map_reverse[ui_index] = replace_id;
-		used_indices_map_reverse.erase(replace_index);
-		used_indices_map[replace_id] = ui_index;
-		used_indices_map.erase(id);
+	private:
+		std::atomic<int64_t> value;
+		std::mutex mutex;
+		std::condition_variable cv;
+	};
 
-		used_indices.pop_back();
+	template <typename T>
+	static void run(void (*fn)(T*), T* data, uint64_t count, Barrier* barrier)
+	{
+		submit(reinterpret_cast<void (*)(void*)>(fn), data, sizeof(T), count, barrier);
 	}
 
-	uint64_t size() const
+	// Fiber local storage is a czsf concept and is ignored.
+	template <typename F, typename T>
+	static void run(F* fls, void (*fn)(T*), T* data, uint64_t count, Barrier* barrier)
 	{
-		return used_indices.size();
+		run(fn, data, count, barrier);
 	}
 
-	void clear()
+	// Queues task i on a worker of node nodes[i]. Idle workers of other
+	// nodes still steal it, so the node is a preference.
+	template <typename T>
+	static void runOnNodes(void (*fn)(T*), T* data, uint64_t count, Barrier* barrier, const uint32_t* nodes)
 	{
-		index_map.clear();
-		used_indices_map.clear();
-		used_indices_map_reverse.clear();
-		free_indices.clear();
+		submit(reinterpret_cast<void (*)(void*)>(fn), data, sizeof(T), count, barrier, nodes);
+	}
 
-		callDestructors();
+	// With placement on and workers pinned across more than one node,
+	// EntityStore tiers are first touched by workers of the nodes they're
+	// spread over and parallelIterate runs each task on the node holding
+	// its entities. Returns 1 otherwise.
+	static uint32_t numaNodes();
+	static void setNumaPlacement(bool enabled);
 
-		for (size_t k = 0; k < tierCount; k++)
-		{
-			addArrayKeys(k);
-			size_t n = 2 << (k + BASE_POWER);
-		}
-		CZSS_CONST_IF (!isVirtual<E>())
-		{
-			memset(entities, 0, sizeof(E) * free_indices.size());
-		}
+	// Writes zeroes to the memory from a cpu of the node, which places its
+	// pages there under the first touch policy.
+	static void touchOnNode(void* p, size_t bytes, uint32_t node);
 
-		used_indices.clear();
-	}
+	// Workers park on their own when idle, activities need no tracking.
+	static void beginActivity() { }
+	static void endActivity() { }
 
-	~EntityStore()
+	struct Activity
 	{
-		callDestructors();
+		Activity() { }
+	};
 
-		for (size_t i = 0; i < tierCount; i++)
-			free(entities[i]);
-	}
+	// Starts the pool with the given number of workers. Without a call the
+	// pool starts hardware_concurrency workers when the first task is run.
+	// Pinned workers fill the cpus of one node before moving to the next.
+	static void start(uint32_t workers, bool pin = false);
 
-	std::vector<E*> used_indices;
-	std::vector<size_t> active;
+	// Joins all workers once their queues are empty.
+	static void stop();
 
-private:
-	E* entities[26];
+	static uint32_t workerCount();
 
-	// empty slots in entities Index
-	std::priority_queue<Index, std::vector<Index>> free_indices;
+	// Node of a pinned worker, 0 for unpinned ones.
+	static uint32_t workerNode(uint32_t worker);
 
-	// maps entity id to entities array
-	std::unordered_map<uint64_t, Index> index_map;
+	// Nanoseconds the worker has spent without a task since it started.
+	static uint64_t idleTime(uint32_t worker);
 
-	// maps entity id to index in used_indices
-	std::unordered_map<uint64_t, uint64_t> used_indices_map;
+	static constexpr uint32_t MAX_WORKERS = 256;
 
-	// reverse of the above
-	std::unordered_map<uint64_t, uint64_t> used_indices_map_reverse;
+private:
+	struct State;
+	static State& state();
+	static void submit(void (*fn)(void*), void* data, size_t stride, uint64_t count, Barrier* barrier, const uint32_t* nodes = nullptr);
+	static bool beginBlocking();
+	static void endBlocking();
+};
 
-	uint64_t nextId = 1;
-	size_t tierCount = 0;
+#ifdef CZSS_BACKEND_THREAD_POOL
+using Backend = ThreadPool;
+#else
+using Backend = CzsfBackend;
+#endif
 
-	void expand()
+// Blocks of memory for the task arrays of parallelIterate, parallelReduce
+// and runTasks. Released blocks are kept and handed out again, never freed,
+// so a call needing no more tasks than earlier ones doesn't allocate.
+struct Scratch
+{
+	static constexpr size_t ALIGNMENT = 64;
+
+	// Returns a block of at least bytes, aligned to ALIGNMENT
+	static void* acquire(size_t bytes);
+	static void release(void* p);
+};
+
+// Array of count Ts in a Scratch block
+template <typename T>
+struct ScratchArray
+{
+	static_assert(alignof(T) <= Scratch::ALIGNMENT, "Scratch blocks aren't aligned enough for T.");
+
+	ScratchArray(size_t count) : count(count)
 	{
-		uint64_t n = 2 << (tierCount + BASE_POWER);
-		addArrayKeys(tierCount);
-		E* p = reinterpret_cast<E*>(malloc(sizeof (E) * n));
-		entities[tierCount] = p;
-		tierCount++;
+		items = reinterpret_cast<T*>(Scratch::acquire(sizeof(T) * count));
+		for (size_t i = 0; i < count; i++)
+			new(&items[i]) T();
 	}
 
-	void callDestructors()
+	ScratchArray(size_t count, const T& value) : count(count)
 	{
-		for (E* ptr : used_indices)
-		{
-			CZSS_CONST_IF (isVirtual<E>())
-				delete(ptr);
-			else
-				ptr->~E();
-		}
+		items = reinterpret_cast<T*>(Scratch::acquire(sizeof(T) * count));
+		for (size_t i = 0; i < count; i++)
+			new(&items[i]) T(value);
 	}
 
-	void addArrayKeys(size_t tier)
+	~ScratchArray()
 	{
-		size_t n = 2 << (tier + BASE_POWER);
-		for (size_t i = 0; i < n; i++)
-			free_indices.push({tier, i});
+		for (size_t i = 0; i < count; i++)
+			items[i].~T();
+		Scratch::release(items);
 	}
-};
 
-// #####################
-// stubs for templates
-// #####################
+	ScratchArray(const ScratchArray&) = delete;
+	ScratchArray& operator=(const ScratchArray&) = delete;
 
-struct TemplateStubs
-{
-	template <typename T>
-	T* getComponent() { return nullptr; }
+	T& operator[](size_t i) { return items[i]; }
+	T* data() { return items; }
 
-	void setGuid(Guid guid);
-	Guid getGuid() const;
+private:
+	size_t count;
+	T* items;
 };
 
-// #####################
-// Primitives
-// #####################
-
-template <typename C>
-struct Component : Dummy, ComponentBase, TemplateStubs
+// Runs f(i) for every i below count as tasks and waits for them. A single
+// task runs inline.
+template <typename F>
+void runTasks(uint64_t count, F&& f)
 {
-	using Cont = std::tuple<>;
+	using Fn = typename std::remove_reference<F>::type;
 
-	friend C;
-private:
-	Component() {};
-};
+	struct Task
+	{
+		Fn* f;
+		uint64_t index;
+	};
 
-template<typename R>
-struct Resource : Dummy, ResourceBase, TemplateStubs
-{
-	using Cont = std::tuple<>;
+	if (count <= 1)
+	{
+		if (count == 1)
+			f(uint64_t(0));
+		return;
+	}
 
-	friend R;
-private:
-	Resource() {};
-};
+	Backend::Activity activity;
+	ScratchArray<Task> tasks(count);
+	for (uint64_t i = 0; i < count; i++)
+		tasks[i] = { &f, i };
+
+	Backend::Barrier barrier(count);
+	Backend::run(+[](Task* task) { (*task->f)(task->index); }, tasks.data(), count, &barrier);
+	barrier.wait();
+}
 
 // #####################
-// Component collection types
+// Profiler
 // #####################
 
-template <typename ...Components>
-struct Iterator : IteratorBase, TemplateStubs
+#define CZSS_PROFILE_CONCAT_(A, B) A##B
+#define CZSS_PROFILE_CONCAT(A, B) CZSS_PROFILE_CONCAT_(A, B)
+
+#ifdef CZSS_PROFILER
+// Scopes are recorded as complete events with begin and end timestamps,
+// async ones as begin and end events sharing the id in arg. Threads write
+// only their own ring, without locking. Reading the rings
+// should happen while nothing is recorded, e.g. between frames.
+struct Profiler
 {
-	using Cont = tuple_utils::Set<Components...>;
+	struct Event
+	{
+		const char* name;
+		const char* category;
+		uint64_t begin;
+		uint64_t end;
+		uint64_t arg;
+		bool async;
+	};
 
-	void setGuid(Guid guid) { this->id = guid; }
-	Guid getGuid() const { return id; }
+	// Events kept per thread, the oldest are overwritten
+	static constexpr uint64_t RING_SIZE = uint64_t(1) << 16;
+
+	static uint64_t now() { return nanoTime(); }
+
+	static void record(const char* name, const char* category, uint64_t begin, uint64_t end, uint64_t arg, bool async = false);
+
+	// A new id for an async scope, above any system index so it doesn't
+	// share a track with a system's spans.
+	static uint64_t asyncId();
+
+	// Chrome trace-event JSON of the recorded events, one track per thread.
+	static std::string chromeTrace();
+	static bool writeChromeTrace(const char* path);
+
+	// Drops the recorded events.
+	static void clear();
 
 private:
-	Guid id;
+	struct Ring;
+	struct Registry;
+	static Registry& registry();
+	static Ring& ring();
 };
 
-struct VirtualArchitecture;
+struct ProfileScope
+{
+	ProfileScope(const char* name, const char* category, uint64_t arg = 0, bool async = false)
+		: name(name), category(category), arg(arg), begin(Profiler::now()), async(async) { }
 
-template <typename ...Components>
-struct Entity : EntityBase
-{
-	using Cont = tuple_utils::Set<Components...>;
+	~ProfileScope()
+	{
+		Profiler::record(name, category, begin, Profiler::now(), arg, async);
+	}
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
 
 private:
-	struct AbstractFilter
+	const char* name;
+	const char* category;
+	uint64_t arg;
+	uint64_t begin;
+	bool async;
+};
+
+#define CZSS_PROFILE_SCOPE(...) czss::ProfileScope CZSS_PROFILE_CONCAT(czssProfileScope, __LINE__)(__VA_ARGS__)
+#define CZSS_PROFILE_ASYNC_SCOPE(name, category, id) czss::ProfileScope CZSS_PROFILE_CONCAT(czssProfileScope, __LINE__)(name, category, id, true)
+#else
+#define CZSS_PROFILE_SCOPE(...)
+#define CZSS_PROFILE_ASYNC_SCOPE(name, category, id)
+#endif
+
+#ifdef CZSS_PERF_COUNTERS
+// Hardware counters of the calling thread, opened on its first read.
+struct PerfCounters
+{
+	enum Counter
 	{
-		template <typename Component>
-		static constexpr bool test()
-		{
-			return std::is_abstract<Component>::value;
-		}
+		CYCLES,
+		INSTRUCTIONS,
+		LLC_MISSES,
+		BRANCH_MISSES,
+		COUNT
 	};
 
-	template <typename T>
-	struct alignas(alignof(T)) AbstractPlaceholder
+	struct Totals
 	{
-		using type = AbstractPlaceholder<T>;
-		AbstractPlaceholder()
+		const char* name;
+		std::atomic<uint64_t> values[COUNT] = { };
+		// Scopes counted, those that moved threads other than by waiting
+		// on a czss barrier are dropped
+		std::atomic<uint64_t> scopes { 0 };
+
+		uint64_t get(Counter counter) const
 		{
-			static_assert(isVirtual<T>());
+			return values[counter].load(std::memory_order_relaxed);
 		}
-		char data[sizeof (T)];
 	};
 
-	using Abstracts = tuple_utils::Subset<Cont, AbstractFilter>;
-	using Concrete = tuple_utils::Difference<Cont, Abstracts>;
-public:
-
-	template <typename Component>
-	static constexpr bool hasComponent()
+	// Totals of a system over its runs and parallelIterate tasks
+	template <typename Arch, typename System>
+	static Totals& of()
 	{
-		return inspect::contains<Cont, Component>();
+		static Totals& totals = add(czss::name<System>());
+		return totals;
 	}
 
-	template <typename T>
-	const T* viewComponent() const
-	{
-		CZSS_CONST_IF(tuple_utils::Contains<Cont, T>::value)
-		{
-			CZSS_CONST_IF(tuple_utils::Contains<Abstracts, T>::value)
-			{
-				return reinterpret_cast<T*>(&std::get<min(tuple_utils::Index<T, Abstracts>::value, std::tuple_size<Abstracts>::value - 1)>(abstracts).data);
-			}
-			else
-			{
-				return &std::get<min(tuple_utils::Index<T, Concrete>::value, std::tuple_size<Concrete>::value - 1)>(concrete);
-			}
-		}
+	// False if no counter could be opened, e.g. when perf_event_paranoid
+	// doesn't allow it.
+	static bool available();
 
-		return nullptr;
+	// Current values of the thread's counters, returns an id of the thread's
+	// counters so reads from different threads can be told apart.
+	static const void* read(uint64_t* values);
+
+	// Table of the totals of each system with instructions per cycle and
+	// misses per thousand instructions.
+	static std::string report();
+	static void reset();
+
+private:
+	static Totals& add(const char* name);
+};
+
+// Counts between its construction and destruction, except while paused.
+// Each thread keeps its open scopes, innermost first.
+struct PerfScope
+{
+	PerfScope(PerfCounters::Totals& totals) : totals(totals), outer(current())
+	{
+		current() = this;
+		start();
 	}
 
-	template<typename T>
-	T* getComponent()
+	~PerfScope()
 	{
-		CZSS_CONST_IF(tuple_utils::Contains<Cont, T>::value)
-		{
-			CZSS_CONST_IF(tuple_utils::Contains<Abstracts, T>::value)
-			{
-				return reinterpret_cast<T*>(&std::get<min(tuple_utils::Index<T, Abstracts>::value, std::tuple_size<Abstracts>::value - 1)>(abstracts).data);
-			}
-			else
-			{
-				return &std::get<min(tuple_utils::Index<T, Concrete>::value, std::tuple_size<Concrete>::value - 1)>(concrete);
-			}
-		}
+		stop();
+		current() = outer;
+		if (dropped)
+			return;
 
-		return nullptr;
+		for (int i = 0; i < PerfCounters::COUNT; i++)
+			totals.values[i].fetch_add(counted[i], std::memory_order_relaxed);
+		totals.scopes.fetch_add(1, std::memory_order_relaxed);
 	}
 
-	template <typename B, typename D>
-	B* setComponent(D&& d)
+	PerfScope(const PerfScope&) = delete;
+	PerfScope& operator=(const PerfScope&) = delete;
+
+	// Stops the calling thread's open scopes before it waits or runs other
+	// tasks, returns them for resume().
+	static PerfScope* pause()
 	{
-		static_assert(isVirtual<B>());
-		static_assert(tuple_utils::Contains<Cont, B>::value);
-		static_assert(std::is_base_of<B, D>::value);
-		static_assert(alignof(B) == alignof(D));
-		static_assert(sizeof(B) == sizeof(D));
-		auto ret = getComponent<B>();
-		new(ret) D(std::move(d));
-		return ret;
+		PerfScope* scopes = current();
+		for (PerfScope* scope = scopes; scope != nullptr; scope = scope->outer)
+			scope->stop();
+		current() = nullptr;
+		return scopes;
 	}
 
-	template <typename B, typename D>
-	B* setComponent()
+	// Restarts scopes returned by pause() on the thread the task continues on.
+	static void resume(PerfScope* scopes)
 	{
-		static_assert(isVirtual<B>());
-		static_assert(tuple_utils::Contains<Cont, B>::value);
-		static_assert(std::is_base_of<B, D>::value);
-		static_assert(alignof(B) == alignof(D));
-		static_assert(sizeof(B) == sizeof(D));
-		auto ret = getComponent<B>();
-		new(ret) D();
-		return ret;
+		for (PerfScope* scope = scopes; scope != nullptr; scope = scope->outer)
+			scope->start();
+		current() = scopes;
 	}
 
-	template <typename B, typename D, typename ...Params>
-	B* setComponent(Params&&... params)
+private:
+	void start()
 	{
-		static_assert(isVirtual<B>());
-		static_assert(tuple_utils::Contains<Cont, B>::value);
-		static_assert(std::is_base_of<B, D>::value);
-		static_assert(alignof(B) == alignof(D));
-		static_assert(sizeof(B) == sizeof(D));
-		auto ret = getComponent<B>();
-		new(ret) D(std::forward(params)...);
-		return ret;
+		counters = PerfCounters::read(begin);
 	}
 
+	void stop()
+	{
+		uint64_t end[PerfCounters::COUNT];
+		if (counters == nullptr || PerfCounters::read(end) != counters)
+		{
+			dropped = true;
+			return;
+		}
 
-	Guid getGuid() const { return {id}; }
-private:
-	void setGuid(Guid guid) { this->id = guid.get(); }
-	friend VirtualArchitecture;
-	uint64_t id;
+		for (int i = 0; i < PerfCounters::COUNT; i++)
+			counted[i] += end[i] - begin[i];
+	}
 
-	RewrapElements<AbstractPlaceholder, Abstracts> abstracts;
-	Concrete concrete;
-};
+	static PerfScope*& current();
 
-template<typename Sys, typename Entity>
-struct TypedEntityAccessor;
+	PerfCounters::Totals& totals;
+	PerfScope* outer;
+	const void* counters;
+	uint64_t begin[PerfCounters::COUNT];
+	uint64_t counted[PerfCounters::COUNT] = { };
+	bool dropped = false;
+};
 
-template <typename Iterator, typename Entity>
-constexpr static bool isIteratorCompatibleWithEntity()
+struct PerfPause
 {
-	using _iteratorComponents = Filter<Flatten<typename Iterator::Cont>, ComponentBase>;
+	PerfPause() : scopes(PerfScope::pause()) { }
+	~PerfPause() { PerfScope::resume(scopes); }
 
-	return isIterator<Iterator>()
-		&& isEntity<Entity>()
-		&& inspect::containsAllIn<Flatten<typename Entity::Cont>, _iteratorComponents>();
-}
-
-// #####################
-// Permissions
-// #####################
+	PerfPause(const PerfPause&) = delete;
+	PerfPause& operator=(const PerfPause&) = delete;
 
-template <typename ...T>
-struct Reader : TemplateStubs, ReaderBase, PermissionsBase
-{
-	using Cont = tuple_utils::Set<T...>;
+private:
+	PerfScope* scopes;
 };
 
-template <typename ...T>
-struct Writer : TemplateStubs, WriterBase, PermissionsBase
-{
-	using Cont = tuple_utils::Set<T...>;
-};
+#define CZSS_PERF_SCOPE(Arch, System) czss::PerfScope CZSS_PROFILE_CONCAT(czssPerfScope, __LINE__)(czss::PerfCounters::of<Arch, System>())
+#define CZSS_PERF_PAUSE() czss::PerfPause CZSS_PROFILE_CONCAT(czssPerfPause, __LINE__)
+#else
+#define CZSS_PERF_SCOPE(Arch, System)
+#define CZSS_PERF_PAUSE()
+#endif
 
-template <typename ...Entities>
-struct Orchestrator : TemplateStubs, OrchestratorBase, PermissionsBase
+#ifdef CZSS_ALLOC_COUNTERS
+// Counts of the calls to operator new and new[], which the implementation
+// replaces.
+struct AllocCounters
 {
-	using Cont = tuple_utils::Set<Entities...>;
-};
+	struct Totals
+	{
+		const char* name;
+		std::atomic<uint64_t> allocations { 0 };
+		std::atomic<uint64_t> bytes { 0 };
+		// Scopes counted, those that moved threads midway are dropped
+		std::atomic<uint64_t> scopes { 0 };
+	};
 
-template <typename Derived>
-struct BaseTypeOfFilter
-{
-	template <typename T>
-	static constexpr bool test()
+	// Totals of a system over its runs and parallelIterate tasks. Under
+	// czsf, allocations of other fibers that ran on the thread while the
+	// system waited are included.
+	template <typename Arch, typename System>
+	static Totals& of()
 	{
-		return std::is_base_of<T, Derived>();
+		static Totals& totals = add(czss::name<System>());
+		return totals;
 	}
-};
-
-template <typename Sys, typename T>
-constexpr bool canOrchestrate()
-{
-	return isVirtual<T>()
-		? std::tuple_size<
-			tuple_utils::Subset<Flatten<Filter<typename Sys::Cont, OrchestratorBase>>, BaseTypeOfFilter<T>>
-		>::value > 0
-		: inspect::contains<Flatten<Filter<typename Sys::Cont, OrchestratorBase>>, T>();
-}
 
-template <typename Sys, typename T>
-constexpr bool canWrite()
-{
-	return inspect::contains<Flatten<Filter<typename Sys::Cont, WriterBase>>, T>()
-		|| canOrchestrate<Sys, T>();
-}
+	// Allocations by all threads since the program started
+	static uint64_t total();
 
+	// Allocations and bytes allocated by the calling thread, returns an id of
+	// the thread's counts so reads from different threads can be told apart.
+	static const void* read(uint64_t* allocations, uint64_t* bytes);
 
-template <typename Sys, typename T>
-constexpr bool canRead()
-{
-	return inspect::contains<Flatten<Filter<typename Sys::Cont, ReaderBase>>, T>()
-		|| canWrite<Sys, T>()
-		|| canOrchestrate<Sys, T>();
-}
+	// Table of the allocations of each system
+	static std::string report();
+	static void reset();
 
-// #####################
-// Graphs
-// #####################
+	// Called by the replaced operator new
+	static void count(size_t bytes);
 
-template <typename ...N>
-struct Dependency : DependencyBase, TemplateStubs
-{
-	using Cont = tuple_utils::Set<N...>;
+private:
+	static Totals& add(const char* name);
 };
 
-template <>
-struct Dependency<> : DependencyBase, TemplateStubs
+struct AllocScope
 {
-	using Cont = std::tuple<>;
-};
+	AllocScope(AllocCounters::Totals& totals) : totals(totals)
+	{
+		counts = AllocCounters::read(&allocations, &bytes);
+	}
 
-template <typename Left, typename Right>
-constexpr static bool directlyDependsOn()
-{
-	return isSystem<Left>() && isSystem<Right>() && inspect::contains<Expand<Filter<typename Left::Cont, DependencyBase>>, Right>();
-}
+	~AllocScope()
+	{
+		uint64_t endAllocations, endBytes;
+		if (AllocCounters::read(&endAllocations, &endBytes) != counts)
+			return;
 
-template <typename Left, typename Right>
-constexpr static bool dependsOn()
-{
-	return isSystem<Left>() && isSystem<Right>() && inspect::contains<Flatten<typename Left::Cont>, Right>();
-}
+		totals.allocations.fetch_add(endAllocations - allocations, std::memory_order_relaxed);
+		totals.bytes.fetch_add(endBytes - bytes, std::memory_order_relaxed);
+		totals.scopes.fetch_add(1, std::memory_order_relaxed);
+	}
 
-template <typename Left, typename Right>
-constexpr static bool redundantDependency()
-{
-	return directlyDependsOn<Left, Right> () && inspect::contains<Flatten<Expand<Expand<Filter<typename Left::Cont, DependencyBase>>>>, Right>();
-}
+	AllocScope(const AllocScope&) = delete;
+	AllocScope& operator=(const AllocScope&) = delete;
 
-template <typename Left, typename Right>
-constexpr static bool transitivelyDependsOn()
-{
-	return isSystem<Left>() && isSystem<Right>() && dependsOn<Left, Right>() && !directlyDependsOn<Left, Right>() && !redundantDependency<Left, Right>();
-}
+private:
+	AllocCounters::Totals& totals;
+	const void* counts;
+	uint64_t allocations;
+	uint64_t bytes;
+};
+
+#define CZSS_ALLOC_SCOPE(Arch, System) czss::AllocScope CZSS_PROFILE_CONCAT(czssAllocScope, __LINE__)(czss::AllocCounters::of<Arch, System>())
+#else
+#define CZSS_ALLOC_SCOPE(Arch, System)
+#endif
 
 // #####################
-// System
+// SIMD kernels
 // #####################
 
-template<typename Arch, typename Sys>
-struct Accessor;
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CZSS_SIMD_X86
+#endif
 
-template <typename ...Permissions>
-struct System : SystemBase, TemplateStubs
+#if defined(__GNUC__) || defined(__clang__)
+#define CZSS_SIMD_INLINE inline __attribute__((always_inline))
+#define CZSS_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define CZSS_SIMD_INLINE inline
+#define CZSS_PREFETCH(p)
+#endif
+
+// Kernels over arrays of arithmetic values. Each kernel is compiled for
+// SSE2, AVX2 and AVX-512 with target attributes and the widest one the cpu
+// supports is picked at runtime. The tail shorter than a vector is loaded
+// into a vector filled with the operation's identity, so arrays needn't
+// be padded. Other compilers and architectures use the scalar loops.
+namespace simd
 {
-	using Cont = tuple_utils::Set<Permissions...>;
-};
 
-template <typename Sys>
-using SystemAccesses = Flatten<tuple_utils::Difference<typename Sys::Cont, Filter<typename Sys::Cont, DependencyBase>>>;
-// using SystemAccesses = Flatten<tuple_union<Filter<typename Sys::Cont, ReaderBase>, Filter<typename Sys::Cont, WriterBase>, Filter<typename Sys::Cont, OrchestratorBase>>>;
+enum class Isa : uint8_t
+{
+	SCALAR,
+	SSE,
+	AVX2,
+	AVX512,
+};
 
-template <typename A, typename B>
-constexpr bool exclusiveWith();
+// Widest instruction set the cpu and os support, detected once.
+Isa detect();
 
-// #####################
-// Architectures
-// #####################
+// Instruction set the kernels use. setIsa can lower it, e.g. to compare
+// paths, but never raise it above detect().
+Isa isa();
+void setIsa(Isa isa);
+const char* isaName(Isa isa);
 
-template <typename Arch, typename Entity>
-struct EntityId
+#if defined(__GNUC__) || defined(__clang__)
+// Vectors only pass through references here, returning them by value from
+// functions without the target's attribute would change the ABI.
+template <typename T, size_t Bytes>
+struct Vector
 {
-private:
-	friend VirtualArchitecture;
-	uint64_t id;
+	typedef T type __attribute__((vector_size(Bytes)));
+	static constexpr size_t lanes = Bytes / sizeof(T);
 
-	EntityId(uint64_t id)
+	static CZSS_SIMD_INLINE void splat(type& v, T value)
 	{
-		this->id = id;
+		v = type { } + value;
 	}
-};
 
-struct VirtualArchitecture
-{
-protected:
-	template<typename Entity>
-	static void setEntityId(Entity* ent, uint64_t id)
+	// Loads n < lanes values, the other lanes are fill
+	static CZSS_SIMD_INLINE void load(type& v, const T* p, size_t n, T fill)
 	{
-		ent->setGuid(Guid(id));
+		splat(v, fill);
+		memcpy(&v, p, n * sizeof(T));
 	}
 
-	template<typename Entity>
-	static uint64_t getEntityId(const Entity* ent)
+	static CZSS_SIMD_INLINE void load(type& v, const T* p)
 	{
-		return ent->getGuid().get();
+		memcpy(&v, p, Bytes);
 	}
 
-	template <typename Arch, typename Entity>
-	static EntityId<Arch, Entity> getEntityId(const Entity* ent)
-	{
-		return EntityId<Arch, Entity>(VirtualArchitecture::getEntityId(ent));
-	}
-
-	template <typename Arch, typename Entity>
-	static uint64_t getEntityId(EntityId<Arch, Entity> key)
+	static CZSS_SIMD_INLINE void store(T* p, const type& v, size_t n = lanes)
 	{
-		return key.id;
+		memcpy(p, &v, n * sizeof(T));
 	}
 };
+#endif
 
-template <typename Arch>
-struct RunTaskData
-{
-	Arch* arch;
-	czsf::Barrier* barriers;
-	uint64_t id;
-};
-
-template <typename Arch, typename Subset>
-struct Runner
+// y[i] += a * x[i]
+struct AxpyKernel
 {
-
-	template <typename Sys>
-	struct SystemBlocker
+	template <size_t Bytes, typename T>
+	static CZSS_SIMD_INLINE void run(T* y, const T* x, T a, size_t n)
 	{
-		template <typename Value>
-		inline static void callback(czsf::Barrier* barriers)
+		size_t i = 0;
+#if defined(__GNUC__) || defined(__clang__)
+		CZSS_CONST_IF (Bytes > 0)
 		{
-			CZSS_CONST_IF (directlyDependsOn<Sys, Value>() && !transitivelyDependsOn<Sys, Value>())
+			using V = Vector<T, Bytes>;
+			typename V::type vx, vy;
+			for (; i < n; i += V::lanes)
 			{
-				barriers[indexOf<Subset, Value, SystemBase>()].wait();
+				size_t count = czss::min(V::lanes, n - i);
+				if (count == V::lanes)
+				{
+					V::load(vx, x + i);
+					V::load(vy, y + i);
+				}
+				else
+				{
+					V::load(vx, x + i, count, T(0));
+					V::load(vy, y + i, count, T(0));
+				}
+				vy += a * vx;
+				V::store(y + i, vy, count);
 			}
+			return;
 		}
-	};
+#endif
+		for (; i < n; i++)
+			y[i] += a * x[i];
+	}
+};
 
-	template <typename Sys>
-	struct DependeeBlocker
+// x[i] = min(max(x[i], lo), hi)
+struct ClampKernel
+{
+	template <size_t Bytes, typename T>
+	static CZSS_SIMD_INLINE void run(T* x, T lo, T hi, size_t n)
 	{
-		template <typename Value>
-		inline static void callback(czsf::Barrier* barriers)
+		size_t i = 0;
+#if defined(__GNUC__) || defined(__clang__)
+		CZSS_CONST_IF (Bytes > 0)
 		{
-			CZSS_CONST_IF (directlyDependsOn<Value, Sys>() && !transitivelyDependsOn<Value, Sys>())
+			using V = Vector<T, Bytes>;
+			typename V::type v, vlo, vhi;
+			V::splat(vlo, lo);
+			V::splat(vhi, hi);
+			for (; i < n; i += V::lanes)
 			{
-				barriers[indexOf<Subset, Value, SystemBase>()].wait();
+				size_t count = czss::min(V::lanes, n - i);
+				if (count == V::lanes)
+					V::load(v, x + i);
+				else
+					V::load(v, x + i, count, lo);
+				v = v < vlo ? vlo : v;
+				v = v > vhi ? vhi : v;
+				V::store(x + i, v, count);
 			}
+			return;
 		}
-	};
-
-	struct SystemRunner
-	{
-		template <typename Value>
-		inline static void callback(uint64_t* id, czsf::Barrier* barriers, Arch* arch)
-		{
-			tuple_utils::OncePerType<Subset, SystemBlocker<Value>>::fn(barriers);
-
-#ifdef CZSS_TIMING_BEGIN
-			CZSS_TIMING_BEGIN<Arch, Value>(arch);
 #endif
-			Accessor<Arch, Value> accessor(arch);
-			Value::run(accessor);
-
-#ifdef CZSS_TIMING_END
-			CZSS_TIMING_END<Arch, Value>(arch);
-#endif
-			barriers[*id].signal();
-		}
-	};
+		for (; i < n; i++)
+			x[i] = x[i] < lo ? lo : (x[i] > hi ? hi : x[i]);
+	}
+};
 
-	struct SystemInitialize
+// Folds x with Op, which is Min, Max or Sum
+template <typename Op>
+struct ReduceKernel
+{
+	template <size_t Bytes, typename T>
+	static CZSS_SIMD_INLINE T run(const T* x, size_t n)
 	{
-		template <typename Value>
-		inline static void callback(const uint64_t* id, czsf::Barrier* barriers, Arch* arch)
+		T result = Op::template identity<T>();
+		size_t i = 0;
+#if defined(__GNUC__) || defined(__clang__)
+		CZSS_CONST_IF (Bytes > 0)
 		{
-			tuple_utils::OncePerType<Subset, SystemBlocker<Value>>::fn(barriers);
-			Accessor<Arch, Value> accessor(arch);
-			Value::initialize(accessor);
-			barriers[*id].signal();
+			using V = Vector<T, Bytes>;
+			typename V::type acc, v;
+			V::splat(acc, result);
+			for (; i + V::lanes <= n; i += V::lanes)
+			{
+				V::load(v, x + i);
+				Op::apply(acc, v);
+			}
+			if (i < n)
+			{
+				V::load(v, x + i, n - i, result);
+				Op::apply(acc, v);
+			}
+			for (size_t lane = 0; lane < V::lanes; lane++)
+				Op::apply(result, T(acc[lane]));
+			return result;
 		}
-	};
+#endif
+		for (; i < n; i++)
+			Op::apply(result, x[i]);
+		return result;
+	}
+};
 
-	struct SystemShutdown
-	{
-		template <typename Value>
-		inline static void callback(uint64_t* id, czsf::Barrier* barriers, Arch* arch)
-		{
-			tuple_utils::OncePerType<Subset, DependeeBlocker<Value>>::fn(barriers);
-			Accessor<Arch, Value> accessor(arch);
-			Value::shutdown(accessor);
-			barriers[*id].signal();
-		}
-	};
+// Operations fold b into a, for scalars and vectors alike
+struct Min
+{
+	template <typename T>
+	static constexpr T identity() { return std::numeric_limits<T>::max(); }
 
-	static void systemCallback(RunTaskData<Arch>* data)
-	{
-		tuple_utils::Switch<Subset>::template fn<SystemRunner>(data->id, &data->id, data->barriers, data->arch);
-	}
+	template <typename V>
+	static CZSS_SIMD_INLINE void apply(V& a, const V& b) { a = b < a ? b : a; }
+};
 
-	static void initializeSystemCallback(RunTaskData<Arch>* data)
-	{
-		tuple_utils::Switch<Subset>::template fn<SystemInitialize>(data->id, &data->id, data->barriers, data->arch);
-	}
+struct Max
+{
+	template <typename T>
+	static constexpr T identity() { return std::numeric_limits<T>::lowest(); }
 
-	static void shutdownSystemCallback(RunTaskData<Arch>* data)
-	{ 
-		tuple_utils::Switch<Subset>::template fn<SystemShutdown>(data->id, &data->id, data->barriers, data->arch);
-	}
+	template <typename V>
+	static CZSS_SIMD_INLINE void apply(V& a, const V& b) { a = a < b ? b : a; }
+};
 
+struct Sum
+{
 	template <typename T>
-	static void runForSystems(Arch* arch, void (*fn)(RunTaskData<Arch>*), T* fls)
-	{
-		static const uint64_t sysCount = numUniques<Subset, SystemBase>();
-		czsf::Barrier barriers[sysCount];
-		RunTaskData<Arch> taskData[sysCount];
+	static constexpr T identity() { return T(0); }
 
-		for (uint64_t i = 0; i < sysCount; i++)
-		{
-			barriers[i].setValue(1);
-			taskData[i].arch = arch;
-			taskData[i].barriers = barriers;
-			taskData[i].id = i;
-		}
+	template <typename V>
+	static CZSS_SIMD_INLINE void apply(V& a, const V& b) { a = a + b; }
+};
 
-		czsf::Barrier wait(sysCount);
-		if (fls == nullptr)
-			czsf::run(fn, taskData, sysCount, &wait);
-		else
-			czsf::run(fls, fn, taskData, sysCount, &wait);
-		wait.wait();
+#ifdef CZSS_SIMD_X86
+template <typename K, typename ...Args>
+__attribute__((target("sse2"))) auto runSse(Args... args)
+{
+	return K::template run<16>(args...);
+}
+
+template <typename K, typename ...Args>
+__attribute__((target("avx2"))) auto runAvx2(Args... args)
+{
+	return K::template run<32>(args...);
+}
+
+template <typename K, typename ...Args>
+__attribute__((target("avx512f"))) auto runAvx512(Args... args)
+{
+	return K::template run<64>(args...);
+}
+#endif
+
+// Runs the kernel with the vector width of isa(), Bytes = 0 is scalar.
+template <typename K, typename ...Args>
+auto dispatch(Args... args)
+{
+#ifdef CZSS_SIMD_X86
+	switch (isa())
+	{
+	case Isa::AVX512:
+		return runAvx512<K>(args...);
+	case Isa::AVX2:
+		return runAvx2<K>(args...);
+	case Isa::SSE:
+		return runSse<K>(args...);
+	default:
+		break;
 	}
-};
+#endif
+	return K::template run<0>(args...);
+}
 
-template <template<typename...> class T, typename ...Values>
-struct RewrapImpl;
+template <typename T>
+void axpy(T* y, const T* x, T a, size_t n)
+{
+	dispatch<AxpyKernel>(y, x, a, n);
+}
 
-template <template<typename...> class T, typename ...Values>
-struct RewrapImpl<T, std::tuple<Values...>>
+template <typename T>
+void clamp(T* x, T lo, T hi, size_t n)
 {
-	using type = T<Values...>;
-};
+	dispatch<ClampKernel>(x, lo, hi, n);
+}
 
-template <template<typename...> class T, typename ...Values>
-using Rewrap = typename RewrapImpl<T, Values...>::type;
+template <typename T>
+T min(const T* x, size_t n)
+{
+	return dispatch<ReduceKernel<Min>>(x, n);
+}
 
-template <typename Entity, typename Accessor>
-void onCreate(Entity& entity, Accessor& accessor) {};
+template <typename T>
+T max(const T* x, size_t n)
+{
+	return dispatch<ReduceKernel<Max>>(x, n);
+}
 
-template <typename Component, typename Entity, typename Accessor>
-void onCreate(Component& component, Entity& entity, Accessor& accessor) {};
+template <typename T>
+T sum(const T* x, size_t n)
+{
+	return dispatch<ReduceKernel<Sum>>(x, n);
+}
 
-template <typename Entity, typename Accessor, typename Context>
-void onCreate(Entity& entity, Accessor& accessor, const Context& context) {};
+} // namespace simd
 
-template <typename Component, typename Entity, typename Accessor, typename Context>
-void onCreate(Component& component, Entity& entity, Accessor& accessor, const Context& context) {};
+// Component and value type of a pointer to a component's data member
+template <typename M>
+struct FieldTraits;
 
-template <typename Entity, typename Accessor>
-void onDestroy(Entity& entity, Accessor& accessor) {};
+template <typename C, typename T>
+struct FieldTraits<T C::*>
+{
+	using Component = C;
+	using Type = T;
+};
 
-template <typename Component, typename Entity, typename Accessor>
-void onDestroy(Component& component, Entity& entity, Accessor& accessor) {};
+// #####################
+// Data Rbox
+// #####################
 
-template <typename Desc, typename ...Contents>
-struct Architecture : VirtualArchitecture
+struct Guid
 {
-	using Cont = tuple_utils::Set<Contents...>;
-	using This = Architecture<Desc, Contents...>;
-	using OmniSystem = System <
-		Rewrap<Orchestrator, Filter<Cont, EntityBase>>,
-		Rewrap<Writer, Filter<Cont, ComponentBase>>,
-		Rewrap<Writer, Filter<Cont, ResourceBase>>
-	>;
+	Guid(const Guid& guid);
+	Guid();
+	Guid(uint64_t id);
+	uint64_t get() const;
+	bool operator ==(const Guid& other) const;
+	bool operator !=(const Guid& other) const;
+	bool operator <(const Guid& other) const;
+private:
+	uint64_t id;
+};
 
-	Accessor<Desc, OmniSystem> accessor()
+struct SpinLock
+{
+	void lock()
 	{
-		return Accessor<Desc, OmniSystem>(reinterpret_cast<Desc*>(this));
+		while (locked.exchange(true, std::memory_order_acquire))
+		{
+			while (locked.load(std::memory_order_relaxed))
+				std::this_thread::yield();
+		}
 	}
 
-	static constexpr uint64_t numEntities() { return numUniques<Cont, EntityBase>(); }
+	void unlock()
+	{
+		locked.store(false, std::memory_order_release);
+	}
 
-	template<typename Entity>
-	static constexpr uint64_t entityIndex()
+private:
+	std::atomic<bool> locked { false };
+};
+
+// Memory held by an EntityStore and how scattered its live slots are.
+// Byte counts of the hash maps are estimates, the node layout is up to the
+// standard library.
+struct StoreStats
+{
+	const char* name = nullptr;
+	bool isVirtual = false;
+	uint64_t live = 0;
+	uint64_t tiers = 0;
+	uint64_t slots = 0;
+	uint64_t freeSlots = 0;
+
+	// Tier memory, or the heap objects of a virtual store
+	uint64_t entityBytes = 0;
+	// used_indices, active bits, slot generations and the positions of
+	// slots in used_indices
+	uint64_t indexBytes = 0;
+	// used_indices_map and its reverse, only virtual stores have them
+	uint64_t mapBytes = 0;
+	// free_indices
+	uint64_t freeListBytes = 0;
+
+	// Live entities of each tier
+	std::vector<uint64_t> tierLive;
+	// First live slot and one past the last
+	uint64_t lowWater = 0;
+	uint64_t highWater = 0;
+	// Runs of adjacent live slots within a tier
+	uint64_t runs = 0;
+
+	uint64_t totalBytes() const
+	{
+		return entityBytes + indexBytes + mapBytes + freeListBytes;
+	}
+
+	// Share of the slots between the first and last live ones that are
+	// free, 0 when the live entities are packed together.
+	double fragmentation() const
+	{
+		uint64_t span = highWater - lowWater;
+		return span == 0 ? 0.0 : double(span - min(live, span)) / span;
+	}
+};
+
+template <typename E>
+struct EntityStore
+{
+	using type = EntityStore<E>;
+
+	EntityStore()
 	{
-		return isEntity<Entity>() ? indexOf<Cont, Entity, EntityBase>() : -1;
+		CZSS_CONST_IF (!isVirtual<E>())
+			expand();
 	}
 
-	template <typename Resource>
-	void setResource(Resource* res)
+	// Ids of non-virtual entities address their slot directly, the bits
+	// above hold the slot's generation, bumped when the slot is freed so a
+	// stale id doesn't resolve to a later entity. Generations start at 1,
+	// a zero id never resolves.
+	static constexpr uint64_t SLOT_BITS = 32;
+	static constexpr uint64_t GENERATION_BITS = 24;
+	static constexpr uint64_t ID_BITS = SLOT_BITS + GENERATION_BITS;
+
+	E* get(uint64_t id)
 	{
-		static_assert(isResource<Resource>(), "Template parameter must be a Resource.");
-		static_assert(inspect::contains<Cont, Resource>(), "Architecture doesn't contain Resource.");
-		static constexpr uint64_t INDEX = indexOf<Cont, Resource, ResourceBase>();
-		std::get<tuple_utils::Index<Resource*, RewrapElements<std::add_pointer, Filter<Cont, ResourceBase>>>::value>(resources) = res;
+		CZSS_CONST_IF (isVirtual<E>())
+		{
+			auto res = used_indices_map.find(id);
+			if (res == used_indices_map.end())
+				return nullptr;
+			return used_indices[res->second];
+		}
+		else
+		{
+			Index index;
+			return find(id, index) ? get(index) : nullptr;
+		}
 	}
 
-	template <typename Alloc>
-	struct ResourceInitializer
+private:
+	static constexpr size_t BASE_POWER = 5;
+	static constexpr uint64_t SLOT_MASK = (uint64_t(1) << SLOT_BITS) - 1;
+	static constexpr uint32_t GENERATION_MASK = (uint32_t(1) << GENERATION_BITS) - 1;
+
+	struct Index
 	{
-		template <typename R>
-		static void callback(This* arch, Alloc& alloc)
+		bool operator< (const Index& other) const
 		{
-			typedef typename std::allocator_traits<Alloc>::template rebind_alloc<R> ralloc;
-			using traits = std::allocator_traits<ralloc>;
-			auto a = ralloc(alloc);
-			auto p = traits::allocate(a, 1);
-			traits::construct(a, p);
-			arch->setResource(p);
+			return tier == other.tier ? index < other.index : tier < other.tier;
 		}
+
+		size_t tier;
+		size_t index;
 	};
 
-	template <typename Alloc>
-	struct ResourceDestructor
+	E* get(const Index& index)
 	{
-		template <typename R>
-		static void callback(This* arch, Alloc& alloc)
-		{
-			typedef typename std::allocator_traits<Alloc>::template rebind_alloc<R> ralloc;
-			using traits = std::allocator_traits<ralloc>;
-			auto a = ralloc(alloc);
-			auto p = arch->template getResource<R>();
-			traits::destroy(a, p);
-			traits::deallocate(a, p, 1);
-		}
-	};
-
-	template <typename T, typename Alloc>
-	void initializeResources(Alloc& alloc)
-	{
-		tuple_utils::OncePerType<T, ResourceInitializer<Alloc>>::fn(this, alloc);
+		return &entities[index.tier][index.index];
 	}
 
-	template <typename Alloc>
-	void initializeResources(Alloc& alloc)
+	inline size_t indexToActiveI(const Index& index) const
 	{
-		using _r = Filter<Cont, ResourceBase>;
-		this->initializeResources<_r, Alloc>(alloc);
+		// The arrays are powers of two in size so offset is calculated
+		// by setting all bits preceding the power of the current tier
+		// to 1 and masking off the section that is below base power
+		// i.e. arrays that don't exist.
+		// e.g. BASE_POWER = 2, index.tier = 1
+		// 00000010 2
+		// 00010000 bit shift
+		// 00001111 subtract
+		// 00001000 and
+		static constexpr size_t maskL = ~size_t(0) << (BASE_POWER + 1);
+		size_t offset = ((size_t(2) << (index.tier + BASE_POWER)) - 1) & maskL;
+		return offset + index.index;
 	}
 
-	template <typename T, typename Alloc>
-	void freeResources(Alloc& alloc)
+	uint64_t slotId(const Index& index) const
 	{
-		tuple_utils::OncePerType<T, ResourceDestructor<Alloc>>::fn(this, alloc);
+		return (uint64_t(generations[index.tier][index.index]) << SLOT_BITS) | indexToActiveI(index);
 	}
 
-	template <typename Alloc>
-	void freeResources(Alloc& alloc)
+	// Finds the slot of a live entity by id
+	bool find(uint64_t id, Index& index) const
 	{
-		using _r = Filter<Cont, ResourceBase>;
-		this->freeResources<_r, Alloc>(alloc);
-	}
+		static constexpr size_t bits = sizeof(size_t) * 8;
+		size_t slot = id & SLOT_MASK;
+		if (slot / bits >= active.size() || !isActive(slot))
+			return false;
 
-	template <typename Resource>
-	Resource* getResource()
-	{
-		static_assert(isResource<Resource>(), "Template parameter must be a Resource.");
-		static_assert(inspect::contains<Cont, Resource>(), "Architecture doesn't contain Resource.");
-		return std::get<tuple_utils::Index<Resource*, RewrapElements<std::add_pointer, Filter<Cont, ResourceBase>>>::value>(resources);
+		size_t tierBegin;
+		index.tier = slotTier(slot, tierBegin);
+		index.index = slot - tierBegin;
+		return generations[index.tier][index.index] == id >> SLOT_BITS;
 	}
 
-	template <typename Entity>
-	EntityStore<Entity>* getEntities()
+	void nextGeneration(const Index& index)
 	{
-		static_assert(inspect::contains<Cont, Entity>(), "Architecture doesn't contain the entity.");
-		// assert(isEntity<Entity>());
-		return &std::get<tuple_utils::Index<EntityStore<Entity>, RewrapElements<EntityStore, Filter<Cont, EntityBase>>>::value>(entities);
+		uint32_t& generation = generations[index.tier][index.index];
+		generation = generation == GENERATION_MASK ? 1 : generation + 1;
 	}
 
-	template <typename Category>
-	static const char* name(uint64_t id)
+public:
+	inline bool isActive(const size_t& i) const
 	{
-		static const char* d = "Unknown";
-		const char** result = &d;
-		tuple_utils::OncePerType<Cont, NameFinder<Category>>::fn(id, result);
-		return *result;
+		size_t mod = i % (sizeof(size_t) * 8);
+		return active[i / (sizeof(size_t) * 8)] & (size_t(1) << mod);
 	}
 
-	void* getEntity(Guid guid)
+	inline void setActive(const size_t& i, const bool& value)
 	{
-		void* ret = nullptr;
-		uint64_t tk = typeKey(guid);
-		tuple_utils::Switch<Filter<Cont, EntityBase>>::template fn<GetEntityVoidPtr>(tk, this, tk, guid, &ret);
-		return ret;
+		size_t mod = i % (sizeof(size_t) * 8);
+		if (value)
+			active[i / (sizeof(size_t) * 8)] |= (size_t(1) << mod);
+		else
+			active[i / (sizeof(size_t) * 8)] &= ~(size_t(1) << mod);
 	}
 
-	template <typename Entity>
-	Entity* getEntity(Guid guid)
+	inline bool isActive(const Index& index) const
 	{
-		return indexOf<Cont, Entity, EntityBase>() == typeKey(guid)
-			? getEntity<Entity>(guidId(guid))
-			: nullptr;
+		return isActive(indexToActiveI(index));
 	}
 
-	template <typename Entity>
-	Entity* getEntity(uint64_t id)
+	inline void setActive(const Index& index, const bool& value)
 	{
-		return getEntities<Entity>()->get(id);
+		setActive(indexToActiveI(index), value);
 	}
 
-private:
-	template <typename System>
-	struct ResolveGuid
+	template <typename T, typename ...Params>
+	T* create(uint64_t& id, Params&&... params)
 	{
-		template <typename T, typename F>
-		static void callback(This* arch, uint64_t key, uint64_t id, F f, bool& result)
+		T* res;
+		auto used_indices_index = used_indices.size();
+
+		CZSS_CONST_IF (isVirtual<T>())
 		{
-			if (entityIndex<T>() == key)
-			{
-				auto entities = arch->template getEntities<T>();
-				auto entity = entities->get(id);
-				if (entity != nullptr)
-				{
-					auto accessor = TypedEntityAccessor<System, T>(entity);
-					f(accessor);
-					result = true;
-				}
-			}
+			id = nextId++;
+			res = new T(std::forward<Params>(params)...);
 		}
-	};
-
-	template <typename System, typename Component>
-	struct AccessComponent
-	{
-		template <typename T, typename F>
-		static void callback(This* arch, uint64_t key, uint64_t id, F f, bool& result)
+		else
 		{
-			if (entityIndex<T>() == key)
-			{
-				auto entities = arch->template getEntities<T>();
-				auto entity = entities->get(id);
-				if (entity != nullptr)
-				{
-					auto accessor = TypedEntityAccessor<System, T>(entity);
-					f(accessor.template getComponent<Component>());
-					result = true;
-				}
-			}
+			if(free_indices.size() == 0)
+				expand();
+
+			auto index = free_indices.top();
+			free_indices.pop();
+			id = slotId(index);
+			res = get(index);
+			new(res) T(std::forward<Params>(params)...);
+			setActive(index, true);
 		}
-	};
 
-	template <typename ...Components>
-	struct ContainsAllComponentsFilter
-	{
-		template <typename Entity>
-		static constexpr bool test()
+		used_indices.push_back(res);
+		CZSS_CONST_IF (isVirtual<T>())
 		{
-			return inspect::containsAllIn<typename Entity::Cont, Filter<Flatten<std::tuple<Components...>>, ComponentBase>>();
+			used_indices_map.insert({id, used_indices_index});
+			used_indices_map_reverse.insert({used_indices_index, id});
+		}
+		else
+		{
+			track(id & SLOT_MASK, used_indices_index);
 		}
-	};
 
-public:
-	template <typename Sys, typename F>
-	bool accessEntity(Guid guid, F f)
-	{
-		bool result = false;
-		tuple_utils::OncePerType<Filter<Cont, EntityBase>, ResolveGuid<Sys>>::fn(this, typeKey(guid), guidId(guid), f, result);
-		return result;
+		return res;
 	}
 
-	template <typename Sys, typename Component, typename F>
-	bool accessComponent(Guid guid,  F f)
+	void destroy(uint64_t id)
 	{
-		using _entities = Filter<Cont, EntityBase>;
-		using _set = tuple_utils::Subset<_entities, ContainsAllComponentsFilter<Component>>;
-		bool result = false;
-		tuple_utils::OncePerType<_set, AccessComponent<Sys, Component>>::fn(this, typeKey(guid), guidId(guid), f, result);
-		return result;
-	}
+		CZSS_CONST_IF (isVirtual<E>())
+		{
+			auto res = used_indices_map.find(id);
+			if (res == used_indices_map.end())
+				return;
 
-	template <typename Sys, typename F, typename ...Components>
-	bool accessEntityFiltered(Guid guid, F f)
-	{
-		using _entities = Filter<Cont, EntityBase>;
-		using _set = tuple_utils::Subset<_entities, ContainsAllComponentsFilter<Components...>>;
-		bool result = false;
-		tuple_utils::OncePerType<_set, ResolveGuid<Sys>>::fn(this, typeKey(guid), guidId(guid), f, result);
-		return result;
-	}
+			delete(used_indices[res->second]);
 
-private:
-	template <typename System, typename Entity>
-	void postInitializeEntity(Guid guid, Entity* ent)
-	{
-		setEntityId(ent, guid.get());
-		auto accessor = Accessor<Desc, System>(reinterpret_cast<Desc*>(this));
-		tuple_utils::OncePerType<typename Entity::Cont, OnCreateCallback>::fn(*ent, accessor);
-		onCreate(*ent, accessor);
-	}
+			auto ui_index = res->second;
 
-	template <typename System, typename Entity, typename Context>
-	void postInitializeEntity(Guid guid, Entity* ent, const Context& context)
-	{
-		setEntityId(ent, guid.get());
-		auto accessor = Accessor<Desc, System>(reinterpret_cast<Desc*>(this));
-		tuple_utils::OncePerType<typename Entity::Cont, OnCreateContextCallback>::fn(*ent, accessor, context);
-		onCreate(*ent, accessor, context);
-	}
+			auto replace_index = used_indices.size() - 1;
+			used_indices[ui_index] = used_indices[replace_index];
+			auto replace_id = used_indices_map_reverse[replace_index];
 
-public:
-	template <typename Entity, typename System, typename ...Params>
-	Entity* createEntity(Params&&... params)
-	{
-		CZSS_CONST_IF (isEntity<Entity>())
+			used_indices_map_reverse[ui_index] = replace_id;
+			used_indices_map_reverse.erase(replace_index);
+			used_indices_map[replace_id] = ui_index;
+			used_indices_map.erase(id);
+		}
+		else
 		{
-			auto ent = initializeEntity<Entity>(std::forward<Params>(params)...);
-			Guid guid = ent->getGuid();
-			postInitializeEntity<System>(guid, ent);
-			return ent;
+			Index index;
+			if (!find(id, index))
+				return;
+
+			auto p = get(index);
+			p->~E();
+			memset(reinterpret_cast<void*>(p), 0, sizeof(E));
+			setActive(index, false);
+			nextGeneration(index);
+			free_indices.push(index);
+
+			// Moves the last entity of used_indices into the freed position
+			uint32_t ui_index = positions[index.tier][index.index];
+			uint32_t replace_slot = used_slots.back();
+			used_indices[ui_index] = used_indices.back();
+			used_slots[ui_index] = replace_slot;
+			size_t tierBegin;
+			size_t tier = slotTier(replace_slot, tierBegin);
+			positions[tier][replace_slot - tierBegin] = ui_index;
+			used_slots.pop_back();
 		}
 
-		return nullptr;
+		used_indices.pop_back();
 	}
 
-	template <typename Entity, typename ...Params>
-	Entity* createEntity(Params&&... params)
+	// Creates an entity from any thread. Each thread takes ids and slots in
+	// batches reserved under a spinlock and fills them without locking. The
+	// entity isn't in used_indices nor found by id until publishConcurrent.
+	// Don't call create or destroy on the store while threads use this.
+	template <typename T, typename ...Params>
+	T* createConcurrent(uint64_t& id, Params&&... params)
 	{
-		return createEntity<Entity, OmniSystem>(std::forward(params)...);
-	}
+		Reservation* reservation = reserve();
+		uint32_t i = reservation->used;
 
-	template <typename Entity, typename System, typename Context, typename ...Params>
-	Entity* createEntityWithContext(const Context& context, Params&&... params)
-	{
-		CZSS_CONST_IF (isEntity<Entity>())
+		T* res;
+		CZSS_CONST_IF (isVirtual<T>())
 		{
-			auto ent = initializeEntity<Entity>(std::forward<Params>(params)...);
-			Guid guid = ent->getGuid();
-			postInitializeEntity<System>(guid, ent, context);
-			return ent;
+			id = reservation->firstId + i;
+			res = new T(std::forward<Params>(params)...);
+		}
+		else
+		{
+			id = slotId(reservation->slots[i]);
+			res = get(reservation->slots[i]);
+			new(res) T(std::forward<Params>(params)...);
 		}
 
-		return nullptr;
+		reservation->created[i] = res;
+		reservation->used = i + 1;
+		return res;
 	}
 
-	template <typename Entity, typename Context, typename ...Params>
-	Entity* createEntityWithContext(const Context& context, Params&&... params)
+	// Makes the entities of createConcurrent visible and returns the slots
+	// reserved but not used. Call when no thread is creating.
+	void publishConcurrent()
 	{
-		return createEntityWithContext<Entity, OmniSystem>(context, std::forward(params)...);
-	}
+		if (reservations.empty())
+			return;
 
-	template <typename Entity>
-	static Guid getEntityGuid(Entity* ent)
-	{
-		return Guid(VirtualArchitecture::getEntityId(ent)
-			+ (indexOf<Cont, Entity, EntityBase>()) << (63 - typeKeyLength()));
-	}
+		CZSS_CONST_IF (!isVirtual<E>())
+			resizeActive();
 
-	template <typename Entity>
-	static EntityId<Desc, Entity> getEntityId(Entity* ent)
-	{
-		return VirtualArchitecture::getEntityId<Desc, Entity>(ent);
-	}
+		for (auto& reservation : reservations)
+		{
+			for (uint32_t i = 0; i < Reservation::SIZE; i++)
+			{
+				if (i < reservation->used)
+				{
+					CZSS_CONST_IF (isVirtual<E>())
+					{
+						uint64_t id = reservation->firstId + i;
+						used_indices_map.insert({id, used_indices.size()});
+						used_indices_map_reverse.insert({used_indices.size(), id});
+					}
+					else
+					{
+						setActive(reservation->slots[i], true);
+						track(indexToActiveI(reservation->slots[i]), used_indices.size());
+					}
 
-	template <typename System, typename Entity>
-	void destroyEntity(Entity& entity)
-	{
-		auto entities = getEntities<Entity>();
-		auto id = guidId(entity.getGuid());
-		auto accessor = Accessor<Desc, System>(reinterpret_cast<Desc*>(this));
-		tuple_utils::OncePerType<typename Entity::Cont, OnDestroyCallback>::fn(entity, accessor);
-		onDestroy(entity, accessor);
-		entities->destroy(id);
+					used_indices.push_back(reservation->created[i]);
+				}
+				else
+				{
+					CZSS_CONST_IF (!isVirtual<E>())
+						free_indices.push(reservation->slots[i]);
+				}
+			}
+		}
+
+		for (auto& reservation : reservations)
+			spareReservations.push_back(std::move(reservation));
+		reservations.clear();
+		epoch = nextEpoch();
 	}
 
-	template <typename Entity>
-	void destroyEntity(Entity& entity)
+	uint64_t size() const
 	{
-		destroyEntity<OmniSystem, Entity>(entity);
+		return used_indices.size();
 	}
 
-	template <typename System, typename Entity>
-	void destroyEntity(uint64_t id)
-	{
-		auto entities = getEntities<Entity>();
-		auto res = entities->get(id);
-		if (res != nullptr)
-			destroyEntity<System>(*res);
-	}
+	// Call when no system creates or destroys entities of the store.
+	StoreStats stats() const
+	{
+		static constexpr size_t bits = sizeof(size_t) * 8;
+		StoreStats s;
+		s.name = czss::name<E>();
+		s.isVirtual = isVirtual<E>();
+		s.live = used_indices.size();
+		s.tiers = tierCount;
+		s.slots = slotCount();
+		s.freeSlots = free_indices.size();
+
+		s.entityBytes = (isVirtual<E>() ? s.live : s.slots) * sizeof(E);
+		s.indexBytes = used_indices.capacity() * sizeof(E*) + active.capacity() * sizeof(size_t) + s.slots * sizeof(uint32_t);
+		if (!isVirtual<E>())
+			s.indexBytes += used_slots.capacity() * sizeof(uint32_t) + s.slots * sizeof(uint32_t);
+		if (isVirtual<E>())
+			s.mapBytes = mapBytes(used_indices_map) + mapBytes(used_indices_map_reverse);
+		s.freeListBytes = free_indices.size() * sizeof(Index);
+
+		s.tierLive.assign(tierCount, 0);
+		size_t tier = 0;
+		size_t tierEnd = size_t(2) << BASE_POWER;
+		size_t previous = 0;
+		for (size_t w = 0; w < active.size(); w++)
+		{
+			if (w * bits >= tierEnd)
+			{
+				tier++;
+				tierEnd += size_t(2) << (tier + BASE_POWER);
+				previous = 0;
+			}
 
-	// todo system parameter, this is used in callback
-	template <typename Entity>
-	void destroyEntity(uint64_t id)
-	{
-		destroyEntity<OmniSystem, Entity>(id);
-	}
+			size_t word = active[w];
+			if (word != 0)
+			{
+				if (s.highWater == 0)
+					s.lowWater = w * bits + std::countr_zero(word);
+				s.highWater = w * bits + bits - std::countl_zero(word);
+			}
 
-	template <typename System>
-	void destroyEntity(Guid guid)
-	{
-		uint64_t tk = typeKey(guid);
-		uint64_t id = guidId(guid);
-		tuple_utils::Switch<Filter<Cont, EntityBase>>::template fn<EntityDestructorCallback<System>>(tk, this, id);
-	}
+			// A run starts at each live slot whose predecessor is free
+			size_t carry = previous >> (bits - 1);
+			s.runs += std::popcount(word & ~((word << 1) | carry));
+			s.tierLive[tier] += std::popcount(word);
+			previous = word;
+		}
 
-	void destroyEntity(Guid guid)
-	{
-		destroyEntity<OmniSystem>(guid);
+		return s;
 	}
 
-	template <typename Entity>
-	void destroyEntity(EntityId<Desc, Entity> key)
+	// Destroys every entity without calling onDestroy. Destructors run as
+	// parallel tasks over used_indices, then the tiers, active bits, free
+	// slots and generations, or the hash maps of a virtual store, are reset
+	// by parallel tasks. Call when no system uses the store.
+	void clear()
 	{
-		destroyEntity<Entity>(This::getEntityId(key));
-	}
+		publishConcurrent();
 
-	template <typename ...Entities>
-	void destroyEntities()
-	{
-		tuple_utils::OncePerType<tuple_utils::Set<Entities...>, DestroyEntitiesCallback>(this);
-	}
+		CZSS_CONST_IF (isVirtual<E>() || !std::is_trivially_destructible<E>::value)
+		{
+			size_t n = used_indices.size();
+			runTasks((n + CLEAR_GRAIN - 1) / CLEAR_GRAIN, [&](uint64_t task) {
+				destroyRange(task * CLEAR_GRAIN, min(n, (task + 1) * CLEAR_GRAIN));
+			});
+		}
 
-	static constexpr uint64_t typeKeyLength()
-	{
-		return ceil(log2(numUniques<Cont, EntityBase>()));
-	}
+		CZSS_CONST_IF (isVirtual<E>())
+		{
+			runTasks(2, [&](uint64_t task) { clearMap(task); });
+		}
+		else
+		{
+			size_t count = 0;
+			for (size_t k = 0; k < tierCount; k++)
+				count += ((size_t(2) << (k + BASE_POWER)) + CLEAR_GRAIN - 1) / CLEAR_GRAIN;
 
-	static uint64_t typeKey(Guid guid)
-	{
-		static const uint64_t klen = typeKeyLength();
-		uint64_t mask = ((uint64_t(1) << (klen + 1)) - 1) << (63 - klen);
-		return (guid.get() & mask) >> (63 - klen);
-	}
-	static uint64_t guidId(Guid guid)
-	{
-		static const uint64_t klen = typeKeyLength();
-		uint64_t key = typeKey(guid) << (63 - klen);
+			ScratchArray<Index> chunks(count);
+			count = 0;
+			for (size_t k = 0; k < tierCount; k++)
+			{
+				size_t n = size_t(2) << (k + BASE_POWER);
+				for (size_t i = 0; i < n; i += CLEAR_GRAIN)
+					chunks[count++] = {k, i};
+			}
 
-		return guid.get() - key;
-	}
+			// Free slots in descending order already form the max heap
+			size_t total = slotCount();
+			std::vector<Index>& slots = free_indices.container();
+			slots.resize(total);
 
-	template <typename V>
-	static constexpr uint64_t absoluteIndex()
-	{
-		return tuple_utils::Index<V, Cont>::value;
+			runTasks(count, [&](uint64_t task) {
+				const Index& chunk = chunks[task];
+				size_t n = size_t(2) << (chunk.tier + BASE_POWER);
+				size_t end = min(n, chunk.index + CLEAR_GRAIN);
+				size_t first = indexToActiveI(chunk);
+				static constexpr size_t bits = sizeof(size_t) * 8;
+
+				for (size_t i = chunk.index; i < end; i++)
+				{
+					if (isActive(first + i - chunk.index))
+						nextGeneration({chunk.tier, i});
+				}
+
+				memset(reinterpret_cast<void*>(&entities[chunk.tier][chunk.index]), 0, sizeof(E) * (end - chunk.index));
+				memset(&active[first / bits], 0, sizeof(size_t) * ((end - chunk.index) / bits));
+				for (size_t i = chunk.index; i < end; i++)
+					slots[total - 1 - (first + i - chunk.index)] = {chunk.tier, i};
+			});
+
+			used_slots.clear();
+		}
+
+		used_indices.clear();
 	}
 
-	static std::string dotGraphString()
+	~EntityStore()
 	{
-		std::string ret("digraph {\n");
+		publishConcurrent();
+		destroyRange(0, used_indices.size());
 
-		tuple_utils::OncePerType<Cont, DotGenerateNodes>::fn(&ret);
-		using Filtered = tuple_utils::Union< Filter<Cont, EntityBase>, Filter<Cont, SystemBase>, Filter<Cont, ComponentBase>, Filter<Cont, IteratorBase>, Filter<Cont, ResourceBase>>;
-		oncePerPair<Filtered, DotGenerateEdges>(&ret);
-		ret += "}\n";
+		for (size_t i = 0; i < tierCount; i++)
+		{
+			free(entities[i]);
+			free(generations[i]);
+			free(positions[i]);
+		}
+	}
 
-		return ret;
+	// Node holding a slot, i.e. an active bit index, of a placed tier
+	uint32_t slotNode(size_t slot) const
+	{
+		size_t tierBegin;
+		size_t tier = slotTier(slot, tierBegin);
+		size_t piece = pieceSlots(tier, tierPieces[tier]);
+		return static_cast<uint32_t>((slot - tierBegin) / piece);
 	}
 
-	struct DotGenerateNodes
+	// Calls f with up to count live entities in slot order, starting at
+	// slot. Returns how many were visited.
+	template <typename F>
+	uint64_t forEachActive(size_t slot, uint64_t count, F&& f)
 	{
-		template<typename V>
-		static void callback(std::string* str)
-		{
-			CZSS_CONST_IF (absoluteIndex<V>() == absoluteIndex<Dummy>())
-				return;
+		static constexpr size_t bits = sizeof(size_t) * 8;
+		uint64_t visited = 0;
+		size_t tierBegin;
+		size_t tier = slotTier(slot, tierBegin);
+		size_t tierEnd = tierBegin + (size_t(2) << (tier + BASE_POWER));
 
-			std::string a;
-			std::string shape = "box";
+		for (size_t w = slot / bits; w < active.size() && visited < count; w++)
+		{
+			// Tiers are multiples of a word in size, words never straddle them
+			if (w * bits >= tierEnd)
+			{
+				tier++;
+				tierBegin = tierEnd;
+				tierEnd += size_t(2) << (tier + BASE_POWER);
+			}
 
-			CZSS_CONST_IF(isSystem<V>())
-				shape = "ellipse";
-			CZSS_CONST_IF(isEntity<V>())
-				shape = "cylinder";
-			CZSS_CONST_IF(isComponent<V>())
-				shape = "rect";
-			CZSS_CONST_IF(isResource<V>())
-				shape = "diamond";
+			size_t word = active[w];
+			if (w == slot / bits)
+				word &= ~size_t(0) << (slot % bits);
 
-			a += std::to_string(absoluteIndex<V>()) + " [label = " + czss::name<V>() + ", shape = " + shape + " ]\n";
-			str->append(a);
+			while (word != 0 && visited < count)
+			{
+				size_t i = w * bits + std::countr_zero(word) - tierBegin;
+				word &= word - 1;
+				f(&entities[tier][i]);
+				visited++;
+			}
 		}
-	};
 
-	struct DotGenerateEdges
-	{
-		template<typename A, typename B>
-		static void callback(std::string* str)
-		{
-			CZSS_CONST_IF (absoluteIndex<A>() == absoluteIndex<Dummy>() || absoluteIndex<B>() == absoluteIndex<Dummy>())
-				return;
+		return visited;
+	}
 
-			std::string an = std::to_string(absoluteIndex<A>());
-			std::string bn = std::to_string(absoluteIndex<B>());
+	// Calls f(first, count) for each run of consecutive live entities within
+	// a tier, split into runs of at most maxRun entities.
+	template <typename F>
+	void forEachRun(size_t maxRun, F&& f)
+	{
+		static constexpr size_t bits = sizeof(size_t) * 8;
+		size_t tier = 0;
+		size_t tierBegin = 0;
+		size_t tierEnd = size_t(2) << BASE_POWER;
+		size_t runBegin = 0;
+		size_t runLength = 0;
+
+		auto flush = [&] {
+			if (runLength > 0)
+				f(&entities[tier][runBegin - tierBegin], runLength);
+			runLength = 0;
+		};
 
-			std::string s;
+		for (size_t w = 0; w < active.size(); w++)
+		{
+			if (w * bits >= tierEnd)
+			{
+				flush();
+				tier++;
+				tierBegin = tierEnd;
+				tierEnd += size_t(2) << (tier + BASE_POWER);
+			}
 
-			CZSS_CONST_IF (isSystem<A>() && isSystem<B>() && !std::is_same<A, B>())
+			size_t word = active[w];
+			while (word != 0)
 			{
-				CZSS_CONST_IF (directlyDependsOn<A, B>())
+				size_t start = std::countr_zero(word);
+				size_t length = std::countr_one(word >> start);
+				size_t slot = w * bits + start;
+
+				if (runLength > 0 && runBegin + runLength != slot)
+					flush();
+				if (runLength == 0)
+					runBegin = slot;
+				runLength += length;
+
+				while (runLength >= maxRun)
 				{
-					CZSS_CONST_IF (!exclusiveWith<A, B>())
-						s += an + " -> " + bn + " [ style = dotted, color = grey ]\n";
-					else if (redundantDependency<A, B>())
-						s += an + " -> " + bn + " [ style = dotted, color = grey ]\n";
-					else
-						s += an + " -> " + bn + "\n";
+					f(&entities[tier][runBegin - tierBegin], maxRun);
+					runBegin += maxRun;
+					runLength -= maxRun;
 				}
 
-				CZSS_CONST_IF (exclusiveWith<A, B>() && !dependsOn<A, B>() && !dependsOn<B, A>())
-						s += an + " -> " + bn + " [ style = dotted ]\n";
+				word = start + length == bits ? 0 : word & (~size_t(0) << (start + length));
 			}
+		}
 
-			CZSS_CONST_IF (isSystem<A>() && isComponent<B>())
-			{
-				CZSS_CONST_IF (canWrite<A, B>())
-					s += an + " -> " + bn + " [ color = yellow ]\n";
+		flush();
+	}
 
-				else CZSS_CONST_IF (canRead<A, B>())
-					s += an + " -> " + bn + " [ color = green ]\n";
-			}
+	std::vector<E*> used_indices;
+	std::vector<size_t> active;
 
-			CZSS_CONST_IF (isSystem<A>() && isEntity<B>())
-			{
-				CZSS_CONST_IF (canOrchestrate<A, B>())
-					s += an + " -> " + bn + " [ color = red ]\n";
-			}
+private:
+	E* entities[26];
 
-			CZSS_CONST_IF (isSystem<A>() && isResource<B>())
-			{
-				CZSS_CONST_IF (isThreadSafe<B>() && canWrite<A, B>())
-					s += an + " -> " + bn + " [ color = green ]\n";
-				else CZSS_CONST_IF (canWrite<A, B>())
-					s += an + " -> " + bn + " [ color = red ]\n";
-				else CZSS_CONST_IF (canRead<A, B>())
-					s += an + " -> " + bn + " [ color = green ]\n";
-			}
+	// Generation of each slot, per tier
+	uint32_t* generations[26];
 
-			CZSS_CONST_IF((isEntity<A>() || isIterator<A>()) && isComponent<B>() && inspect::contains<Flatten<typename A::Cont>, B>())
-				s += an + " -> " + bn + "\n";
+	// Position in used_indices of the entity in each live slot, per tier.
+	// Non-virtual stores find the entity to move on destroy through these
+	// instead of the hash maps, so create and destroy don't allocate.
+	uint32_t* positions[26];
 
-			str->append(s);
-		}
-	};
+	// Slot of each entity of used_indices, non-virtual stores only
+	std::vector<uint32_t> used_slots;
 
-private:
-	RewrapElements<std::add_pointer, Filter<Cont, ResourceBase>> resources;
-	RewrapElements<EntityStore, Filter<Cont, EntityBase>> entities;
+	// Number of nodes each tier is spread over
+	uint32_t tierPieces[26];
 
-	template <typename Entity, typename ...Params>
-	Entity* initializeEntity(Params&&... params)
+	// Max heap of empty slots in entities. clear() refills its container in
+	// place rather than building a new one.
+	struct FreeIndices : std::priority_queue<Index, std::vector<Index>>
 	{
-		static_assert(isEntity<Entity>(), "Template parameter must be an Entity.");
+		std::vector<Index>& container() { return this->c; }
+	};
 
-		Entity* ent;
-		uint64_t tk = entityIndex<Entity>() << 63 - typeKeyLength();
-		uint64_t id;
-		auto entities = getEntities<Entity>();
-		ent = entities->template create<Entity>(id, std::forward<Params>(params)...);
+	// empty slots in entities Index
+	FreeIndices free_indices;
 
-		id += tk;
-		setEntityId(ent, id);
+	// maps entity id to index in used_indices, virtual stores only
+	std::unordered_map<uint64_t, uint64_t> used_indices_map;
 
-		return ent;
-	}
+	// reverse of the above
+	std::unordered_map<uint64_t, uint64_t> used_indices_map_reverse;
 
-	struct DestroyEntitiesCallback
+	std::atomic<uint64_t> nextId { 1 };
+	size_t tierCount = 0;
+
+	struct Reservation
 	{
-		template <typename Value>
-		static void callback(This* arch)
-		{
-			EntityStore<Value>* entities = arch->template getEntities<Value>();
-			entities->clear();
-		}
+		static constexpr uint32_t SIZE = 64;
+
+		uint64_t firstId = 0;
+		uint32_t used = 0;
+		Index slots[SIZE];
+		E* created[SIZE];
 	};
 
-	template <typename System>
-	struct EntityDestructorCallback
+	// Batches handed out by createConcurrent since the last publish, and
+	// the published ones kept for reuse
+	std::vector<std::unique_ptr<Reservation>> reservations;
+	std::vector<std::unique_ptr<Reservation>> spareReservations;
+	SpinLock reservationLock;
+
+	// Invalidates the batches threads hold on to when changed. Unique across
+	// stores so a thread never reuses a batch of a destroyed store.
+	uint64_t epoch = nextEpoch();
+
+	static uint64_t nextEpoch()
 	{
-		template <typename Value>
-		inline static void callback(This* arch, const uint64_t& id)
-		{
-			arch->template destroyEntity<System, Value>(id);
-		}
-	};
+		static std::atomic<uint64_t> counter { 0 };
+		return ++counter;
+	}
 
-	struct GetEntityVoidPtr
+	Reservation* reserve()
 	{
-		template <typename Value>
-		inline static void callback(This* arch, const uint64_t& typeKey, const Guid& guid, void** ret)
+		struct Cache
 		{
-			if(isEntity<Value>() && inspect::contains<Cont, Value>() && indexOf<Cont, Value, EntityBase>() == typeKey)
-				*ret = arch->template getEntity<Value>(guid);
-		}
-	};
+			const EntityStore* store = nullptr;
+			uint64_t epoch = 0;
+			Reservation* reservation = nullptr;
+		};
 
-	template <typename Cat>
-	struct NameFinder
-	{
-		template <typename Value>
-		inline static void callback(uint64_t id, const char** res)
+		static thread_local Cache cache;
+		if (cache.store == this && cache.epoch == epoch && cache.reservation->used < Reservation::SIZE)
+			return cache.reservation;
+
+		std::unique_ptr<Reservation> reservation;
 		{
-			if (std::is_base_of<Cat, Value>() && indexOf<Cont, Value, Cat>() == id)
+			std::lock_guard<SpinLock> lock(reservationLock);
+			if (!spareReservations.empty())
 			{
-				*res = czss::name<Value>();
+				reservation = std::move(spareReservations.back());
+				spareReservations.pop_back();
+				reservation->used = 0;
 			}
 		}
-	};
 
-	struct OnCreateCallback
-	{
-		template <typename Component, typename Entity, typename Accessor>
-		inline static void callback(Entity& value, Accessor& accessor)
+		if (!reservation)
+			reservation = std::make_unique<Reservation>();
+		CZSS_CONST_IF (isVirtual<E>())
+			reservation->firstId = nextId.fetch_add(Reservation::SIZE);
+		Reservation* res = reservation.get();
 		{
-			onCreate(*value.template getComponent<Component>(), value, accessor);
-		}
-	};
+			std::lock_guard<SpinLock> lock(reservationLock);
+			CZSS_CONST_IF (!isVirtual<E>())
+			{
+				// The active bits grow on publish, iterations running
+				// meanwhile never see the new tier.
+				for (uint32_t i = 0; i < Reservation::SIZE; i++)
+				{
+					if (free_indices.size() == 0)
+						addTier();
 
-	struct OnCreateContextCallback
-	{
-		template <typename Component, typename Entity, typename Accessor, typename Context>
-		inline static void callback(Entity& value, Accessor& accessor, const Context& context)
-		{
-			onCreate(*value.template getComponent<Component>(), value, accessor, context);
+					res->slots[i] = free_indices.top();
+					free_indices.pop();
+				}
+			}
+			reservations.push_back(std::move(reservation));
 		}
-	};
 
-	struct OnDestroyCallback
-	{
-		template <typename Component, typename Entity, typename Accessor>
-		inline static void callback(Entity& value, Accessor& accessor)
-		{
-			onDestroy(*value.template getComponent<Component>(), value, accessor);
-		}
-	};
-};
+		cache = { this, epoch, res };
+		return res;
+	}
 
-// #####################
-// Accessors
-// #####################
+	void expand()
+	{
+		addTier();
+		resizeActive();
+	}
 
-template<typename Sys>
-struct HasEntityReadPermissionCallback
-{
-	template <typename Value>
-	static void callback()
+	void addTier()
 	{
-		static_assert(canRead<Sys, Value>(), "System cannot read component.");
+		uint64_t n = 2 << (tierCount + BASE_POWER);
+		addArrayKeys(tierCount);
+		E* p = reinterpret_cast<E*>(malloc(sizeof (E) * n));
+		entities[tierCount] = p;
+		generations[tierCount] = reinterpret_cast<uint32_t*>(malloc(sizeof (uint32_t) * n));
+		std::fill_n(generations[tierCount], n, uint32_t(1));
+		positions[tierCount] = reinterpret_cast<uint32_t*>(malloc(sizeof (uint32_t) * n));
+		tierPieces[tierCount] = place(p, tierCount);
+		tierCount++;
 	}
-};
 
-template<typename Sys>
-struct HasEntityWritePermissionCallback
-{
-	template <typename Value>
-	static void callback()
+	void resizeActive()
 	{
-		static_assert(canWrite<Sys, Value>(), "System cannot write to component.");
+		active.resize(slotCount() / (sizeof(size_t) * 8), 0);
 	}
-};
-
-template <typename Iter, typename Arch, typename Sys>
-struct IteratorAccessor;
 
-template <typename Iter, typename Arch, typename Sys>
-struct IterableStub;
+	// Spreads a tier over the nodes in equal pieces of whole active words so
+	// parallelIterate can hand each node the entities in its own memory.
+	uint32_t place(E* p, size_t tier)
+	{
+		uint32_t nodes = Backend::numaNodes();
+		if (nodes <= 1)
+			return 1;
 
-template <typename Iter, typename Arch, typename Sys>
-struct IteratorIterator;
+		size_t n = size_t(2) << (tier + BASE_POWER);
+		size_t piece = pieceSlots(tier, nodes);
+		uint32_t pieces = 0;
+		for (size_t i = 0; i < n; i += piece)
+			Backend::touchOnNode(p + i, sizeof(E) * min(piece, n - i), pieces++);
 
-template<typename Arch, typename Sys>
-struct Accessor;
+		return pieces;
+	}
 
-template <typename Base, typename Derived>
-struct PermissionCompare
-{
-	template <typename V>
-	static constexpr void callback()
+	static size_t pieceSlots(size_t tier, uint32_t pieces)
 	{
-		static_assert(isEntity<V>() && canOrchestrate<Derived, V>() ? canOrchestrate<Base, V>()
-				: ((isComponent<V>() || isResource<V>()) && canWrite<Derived, V>() ? canWrite<Base, V>()
-					: ((isComponent<V>() || isResource<V>()) && canRead<Derived, V>() ? canRead<Base, V>()
-						: true)),
-			"Derived accessor must have same or lesser permissions than the original.");
+		static constexpr size_t bits = sizeof(size_t) * 8;
+		size_t n = size_t(2) << (tier + BASE_POWER);
+		size_t piece = (n / pieces + bits - 1) / bits * bits;
+		return max(piece, bits);
 	}
-};
-
-template <typename Base, typename Derived>
-static constexpr void canDeriveAssert()
-{
-	tuple_utils::OncePerType<typename Derived::Cont, PermissionCompare<Base, Derived>>::fn();
-}
 
-template<typename Sys, typename Entity>
-struct TypedEntityAccessor
-{
-	template <typename P>
-	operator TypedEntityAccessor<P, Entity>& ()
+	static size_t slotTier(size_t slot, size_t& tierBegin)
 	{
-		canDeriveAssert<Sys, P>();
-		return *reinterpret_cast<TypedEntityAccessor<P, Entity>*>(this);
+		static constexpr size_t base = size_t(2) << BASE_POWER;
+		size_t tier = std::bit_width(slot / base + 1) - 1;
+		tierBegin = (base << tier) - base;
+		return tier;
 	}
 
-	TypedEntityAccessor(const Entity* ent)
+	// Entities per task of clear, a multiple of the active word size
+	static constexpr size_t CLEAR_GRAIN = size_t(1) << 16;
+
+	void destroyRange(size_t begin, size_t end)
 	{
-		_entity = const_cast<Entity*>(ent);
+		for (size_t i = begin; i < end; i++)
+		{
+			CZSS_CONST_IF (isVirtual<E>())
+				delete(used_indices[i]);
+			else
+				used_indices[i]->~E();
+		}
 	}
 
-	template<typename Component>
-	const Component* viewComponent() const
+	// Records that the entity in slot is at position of used_indices
+	void track(size_t slot, size_t position)
 	{
-		static_assert(canRead<Sys, Component>(), "System lacks read permissions for the Iterator's components.");
-		return _entity->template viewComponent<Component>();
+		size_t tierBegin;
+		size_t tier = slotTier(slot, tierBegin);
+		positions[tier][slot - tierBegin] = static_cast<uint32_t>(position);
+		used_slots.push_back(static_cast<uint32_t>(slot));
 	}
 
-	template<typename Component>
-	Component* getComponent()
+	void clearMap(uint64_t map)
 	{
-		static_assert(canWrite<Sys, Component>(), "System lacks write permissions for the Iterator's components.");
-		return _entity->template getComponent<Component>();
+		if (map == 0)
+			used_indices_map.clear();
+		else
+			used_indices_map_reverse.clear();
 	}
 
-	Guid getGuid() const
+	template <typename Map>
+	static uint64_t mapBytes(const Map& map)
 	{
-		return _entity->getGuid();
+		// A node holds the value and a next pointer, buckets a pointer each
+		return map.size() * (sizeof(typename Map::value_type) + sizeof(void*)) + map.bucket_count() * sizeof(void*);
 	}
 
-	const Entity* viewEntity() const
+	size_t slotCount() const
 	{
-		tuple_utils::OncePerType<Flatten<typename Entity::Cont>, HasEntityReadPermissionCallback<Sys>>::fn();
-		return _entity;
+		return tierCount == 0 ? 0 : (size_t(2) << (tierCount + BASE_POWER)) - (size_t(2) << BASE_POWER);
 	}
 
-	Entity* getEntity()
+	void addArrayKeys(size_t tier)
 	{
-		tuple_utils::OncePerType<Flatten<typename Entity::Cont>, HasEntityWritePermissionCallback<Sys>>::fn();
-		return _entity;
+		size_t n = 2 << (tier + BASE_POWER);
+		for (size_t i = 0; i < n; i++)
+			free_indices.push({tier, i});
 	}
-
-private:
-	Entity* _entity;
 };
 
-template <typename Arch, typename Sys>
-struct EntityAccessor
-{
-	template <typename P>
-	operator EntityAccessor<Arch, P>& ()
-	{
-		canDeriveAssert<Sys, P>();
-		return *reinterpret_cast<EntityAccessor<Arch, P>*>(this);
-	}
+// #####################
+// stubs for templates
+// #####################
 
-	template <typename Entity>
-	EntityAccessor(const Entity* ent)
-	{
-		entity = const_cast<Entity*>(ent);
-		typeKey = indexOf<typename Arch::Cont, Entity, EntityBase>();
-	}
+struct TemplateStubs
+{
+	template <typename T>
+	T* getComponent() { return nullptr; }
 
-	template <typename Component>
-	bool hasComponent() const
-	{
-		return viewComponent<Component>() != nullptr;
-	}
+	void setGuid(Guid guid);
+	Guid getGuid() const;
+};
 
-	template<typename Component>
-	const Component* viewComponent() const
-	{
-		static_assert(canRead<Sys, Component>(), "System lacks read permissions for the Iterator's components.");
-		return get_ptr<Component>();
-	}
+// #####################
+// Primitives
+// #####################
 
-	template<typename Component>
-	Component* getComponent()
-	{
-		static_assert(canWrite<Sys, Component>(), "System lacks write permissions for the Iterator's components.");
-		return get_ptr<Component>();
-	}
+template <typename C>
+struct Component : Dummy, ComponentBase, TemplateStubs
+{
+	using Cont = std::tuple<>;
 
-	Guid getGuid() const
-	{
-		Guid guid;
+	friend C;
+private:
+	Component() {};
+};
 
-		tuple_utils::Switch<Filter<typename Arch::Cont, EntityBase>>::template fn<GuidGetter>(typeKey, &guid, entity);
-		return guid;
-	}
+template<typename R>
+struct Resource : Dummy, ResourceBase, TemplateStubs
+{
+	using Cont = std::tuple<>;
 
-	bool null() const
-	{
-		return entity == nullptr;
-	}
+	friend R;
+private:
+	Resource() {};
+};
 
-protected:
-	EntityAccessor()
-	{
-		entity = nullptr;
-	}
+// #####################
+// Component collection types
+// #####################
 
-	EntityAccessor(const EntityAccessor<Arch, Sys>& other)
-	{
-		this->typeKey = other.typeKey;
-		this->entity = other.entity;
-	}
+template <typename ...Components>
+struct Iterator : IteratorBase, TemplateStubs
+{
+	using Cont = tuple_utils::Set<Components...>;
 
-	EntityAccessor(uint64_t typeKey, void* entity)
-	{
-		this->typeKey = typeKey;
-		this->entity = entity;
-	}
+	void setGuid(Guid guid) { this->id = guid; }
+	Guid getGuid() const { return id; }
 
 private:
-	friend Accessor<Arch, Sys>;
-	uint64_t typeKey;
-	void* entity;
+	Guid id;
+};
 
-	template <typename Component>
-	Component* get_ptr() const
-	{
-		void* result = nullptr;
-		tuple_utils::Switch<Filter<typename Arch::Cont, EntityBase>>::template fn<ComponentGetter<Component>>(typeKey, entity, &result);
-		return reinterpret_cast<Component*>(result);
-	}
+struct VirtualArchitecture;
 
-	template <typename Component>
-	struct Callback
+template <typename ...Components>
+struct Entity : EntityBase
+{
+	using Cont = tuple_utils::Set<Components...>;
+
+private:
+	struct AbstractFilter
 	{
-		template <typename Value, typename Entity>
-		static void callback(Entity* entity, void** result)
+		template <typename Component>
+		static constexpr bool test()
 		{
-			CZSS_CONST_IF (std::is_same<Component, Value>())
-				*result = entity->template getComponent<Value>();
+			return std::is_abstract<Component>::value;
 		}
 	};
 
-	template <typename Component>
-	struct ComponentGetter
+	template <typename T>
+	struct alignas(alignof(T)) AbstractPlaceholder
 	{
-		template <typename Value>
-		inline static void callback(void* entity, void** result)
+		using type = AbstractPlaceholder<T>;
+		AbstractPlaceholder()
 		{
-			tuple_utils::OncePerType<typename Value::Cont, Callback<Component>>::fn(reinterpret_cast<Value*>(entity), result);
+			static_assert(isVirtual<T>());
 		}
+		char data[sizeof (T)];
 	};
 
-	struct GuidGetter
+	using Abstracts = tuple_utils::Subset<Cont, AbstractFilter>;
+	using Concrete = tuple_utils::Difference<Cont, Abstracts>;
+	using Buffers = tuple_utils::Subset<Concrete, BufferedFilter>;
+
+	struct CommitCallback
 	{
-		template <typename Value>
-		inline static void callback(Guid* guid, void* entity)
+		template <typename Component>
+		static void callback(Entity* entity)
 		{
-			*guid = reinterpret_cast<Value*>(entity)->getGuid();
+			std::get<tuple_utils::Index<Component, Buffers>::value>(entity->committed)
+				= std::get<tuple_utils::Index<Component, Concrete>::value>(entity->concrete);
 		}
 	};
-};
-
-template <typename Iter, typename Arch, typename Sys>
-struct IteratorAccessor : EntityAccessor<Arch, Sys>
-{
-	IteratorAccessor(const IteratorAccessor<Iter, Arch, Sys>& other) : EntityAccessor<Arch, Sys>(other) { }
+public:
 
 	template <typename Component>
-	bool hasComponent() const
+	static constexpr bool hasComponent()
 	{
-		return EntityAccessor<Arch, Sys>::template hasComponent<Component>();
+		return inspect::contains<Cont, Component>();
 	}
 
-	template<typename Component>
-	const Component* viewComponent() const
+	template <typename T>
+	const T* viewComponent() const
 	{
-		return EntityAccessor<Arch, Sys>::template viewComponent<Component>();
-	}
+		CZSS_CONST_IF(tuple_utils::Contains<Cont, T>::value)
+		{
+			CZSS_CONST_IF(tuple_utils::Contains<Abstracts, T>::value)
+			{
+				return reinterpret_cast<T*>(&std::get<min(tuple_utils::Index<T, Abstracts>::value, std::tuple_size<Abstracts>::value - 1)>(abstracts).data);
+			}
+			else
+			{
+				return &std::get<min(tuple_utils::Index<T, Concrete>::value, std::tuple_size<Concrete>::value - 1)>(concrete);
+			}
+		}
 
-	template<typename Component>
-	Component* getComponent()
-	{
-		return EntityAccessor<Arch, Sys>::template getComponent<Component>();
+		return nullptr;
 	}
 
-private:
-	friend IteratorIterator<Iter, Arch, Sys>;
-	friend Accessor<Arch, Sys>;
+	// Copy of a Buffered component as of the last commit, or the live
+	// component if T isn't Buffered.
+	template <typename T>
+	const T* viewCommitted() const
+	{
+		CZSS_CONST_IF(tuple_utils::Contains<Buffers, T>::value)
+		{
+			return &std::get<min(tuple_utils::Index<T, Buffers>::value, std::tuple_size<Buffers>::value - 1)>(committed);
+		}
 
-	IteratorAccessor() {}
-	template <typename Entity>
-	IteratorAccessor(Entity* ent) : EntityAccessor<Arch, Sys>(ent) { }
-	IteratorAccessor(uint64_t key, void* entity) : EntityAccessor<Arch, Sys>(key, entity) { }
-};
+		return viewComponent<T>();
+	}
 
-template <typename Iter>
-struct IteratorCompatabilityFilter
-{
-	template <typename Entity>
-	static constexpr bool test()
+	void commitBuffered()
 	{
-		return isEntity<Entity>() && isIteratorCompatibleWithEntity<Iter, Entity>();
+		tuple_utils::OncePerType<Buffers, CommitCallback>::fn(this);
+	}
+
+	template<typename T>
+	T* getComponent()
+	{
+		CZSS_CONST_IF(tuple_utils::Contains<Cont, T>::value)
+		{
+			CZSS_CONST_IF(tuple_utils::Contains<Abstracts, T>::value)
+			{
+				return reinterpret_cast<T*>(&std::get<min(tuple_utils::Index<T, Abstracts>::value, std::tuple_size<Abstracts>::value - 1)>(abstracts).data);
+			}
+			else
+			{
+				return &std::get<min(tuple_utils::Index<T, Concrete>::value, std::tuple_size<Concrete>::value - 1)>(concrete);
+			}
+		}
+
+		return nullptr;
+	}
+
+	template <typename B, typename D>
+	B* setComponent(D&& d)
+	{
+		static_assert(isVirtual<B>());
+		static_assert(tuple_utils::Contains<Cont, B>::value);
+		static_assert(std::is_base_of<B, D>::value);
+		static_assert(alignof(B) == alignof(D));
+		static_assert(sizeof(B) == sizeof(D));
+		auto ret = getComponent<B>();
+		new(ret) D(std::move(d));
+		return ret;
+	}
+
+	template <typename B, typename D>
+	B* setComponent()
+	{
+		static_assert(isVirtual<B>());
+		static_assert(tuple_utils::Contains<Cont, B>::value);
+		static_assert(std::is_base_of<B, D>::value);
+		static_assert(alignof(B) == alignof(D));
+		static_assert(sizeof(B) == sizeof(D));
+		auto ret = getComponent<B>();
+		new(ret) D();
+		return ret;
+	}
+
+	template <typename B, typename D, typename ...Params>
+	B* setComponent(Params&&... params)
+	{
+		static_assert(isVirtual<B>());
+		static_assert(tuple_utils::Contains<Cont, B>::value);
+		static_assert(std::is_base_of<B, D>::value);
+		static_assert(alignof(B) == alignof(D));
+		static_assert(sizeof(B) == sizeof(D));
+		auto ret = getComponent<B>();
+		new(ret) D(std::forward(params)...);
+		return ret;
+	}
+
+
+	Guid getGuid() const { return {id}; }
+private:
+	void setGuid(Guid guid) { this->id = guid.get(); }
+	friend VirtualArchitecture;
+	uint64_t id;
+
+	RewrapElements<AbstractPlaceholder, Abstracts> abstracts;
+	Concrete concrete;
+	Buffers committed;
+};
+
+template<typename Sys, typename Entity>
+struct TypedEntityAccessor;
+
+template <typename Iterator, typename Entity>
+constexpr static bool isIteratorCompatibleWithEntity()
+{
+	using _iteratorComponents = Filter<Flatten<typename Iterator::Cont>, ComponentBase>;
+
+	return isIterator<Iterator>()
+		&& isEntity<Entity>()
+		&& inspect::containsAllIn<Flatten<typename Entity::Cont>, _iteratorComponents>();
+}
+
+// #####################
+// Permissions
+// #####################
+
+template <typename ...T>
+struct Reader : TemplateStubs, ReaderBase, PermissionsBase
+{
+	using Cont = tuple_utils::Set<T...>;
+};
+
+template <typename ...T>
+struct Writer : TemplateStubs, WriterBase, PermissionsBase
+{
+	using Cont = tuple_utils::Set<T...>;
+};
+
+template <typename ...Entities>
+struct Orchestrator : TemplateStubs, OrchestratorBase, PermissionsBase
+{
+	using Cont = tuple_utils::Set<Entities...>;
+};
+
+template <typename Derived>
+struct BaseTypeOfFilter
+{
+	template <typename T>
+	static constexpr bool test()
+	{
+		return std::is_base_of<T, Derived>();
+	}
+};
+
+template <typename Sys, typename T>
+constexpr bool canOrchestrate()
+{
+	return isVirtual<T>()
+		? std::tuple_size<
+			tuple_utils::Subset<Flatten<Filter<typename Sys::Cont, OrchestratorBase>>, BaseTypeOfFilter<T>>
+		>::value > 0
+		: inspect::contains<Flatten<Filter<typename Sys::Cont, OrchestratorBase>>, T>();
+}
+
+template <typename Sys, typename T>
+constexpr bool canWrite()
+{
+	return inspect::contains<Flatten<Filter<typename Sys::Cont, WriterBase>>, T>()
+		|| canOrchestrate<Sys, T>();
+}
+
+
+template <typename Sys, typename T>
+constexpr bool canRead()
+{
+	return inspect::contains<Flatten<Filter<typename Sys::Cont, ReaderBase>>, T>()
+		|| canWrite<Sys, T>()
+		|| canOrchestrate<Sys, T>();
+}
+
+// #####################
+// Graphs
+// #####################
+
+template <typename ...N>
+struct Dependency : DependencyBase, TemplateStubs
+{
+	using Cont = tuple_utils::Set<N...>;
+};
+
+template <>
+struct Dependency<> : DependencyBase, TemplateStubs
+{
+	using Cont = std::tuple<>;
+};
+
+template <typename Left, typename Right>
+constexpr static bool directlyDependsOn()
+{
+	return isSystem<Left>() && isSystem<Right>() && inspect::contains<Expand<Filter<typename Left::Cont, DependencyBase>>, Right>();
+}
+
+template <typename Left, typename Right>
+constexpr static bool dependsOn()
+{
+	return isSystem<Left>() && isSystem<Right>() && inspect::contains<Flatten<typename Left::Cont>, Right>();
+}
+
+template <typename Left, typename Right>
+constexpr static bool redundantDependency()
+{
+	return directlyDependsOn<Left, Right> () && inspect::contains<Flatten<Expand<Expand<Filter<typename Left::Cont, DependencyBase>>>>, Right>();
+}
+
+template <typename Left, typename Right>
+constexpr static bool transitivelyDependsOn()
+{
+	return isSystem<Left>() && isSystem<Right>() && dependsOn<Left, Right>() && !directlyDependsOn<Left, Right>() && !redundantDependency<Left, Right>();
+}
+
+// #####################
+// System
+// #####################
+
+template<typename Arch, typename Sys>
+struct Accessor;
+
+template <typename ...Permissions>
+struct System : SystemBase, TemplateStubs
+{
+	using Cont = tuple_utils::Set<Permissions...>;
+};
+
+struct RunRateBase {};
+struct FixedTimestepBase {};
+
+// Systems inheriting RunEvery only run on frames where
+// frame % Period == Phase when scheduled with Runner::runFrame.
+template <uint64_t Period, uint64_t Phase = 0>
+struct RunEvery : RunRateBase
+{
+	static_assert(Period > 0 && Phase < Period, "Phase must be less than a non-zero Period.");
+	static constexpr uint64_t runPeriod = Period;
+	static constexpr uint64_t runPhase = Phase;
+};
+
+// Systems inheriting FixedTimestep run once for every Num / Den seconds of
+// frame time accumulated by Runner::runFrame, at most MaxSteps times a
+// frame. Time beyond MaxSteps is dropped rather than carried over. Combined
+// with RunEvery, time accumulated over skipped frames is run on the next
+// due frame.
+template <uint64_t Num, uint64_t Den = 1, uint64_t MaxSteps = 8>
+struct FixedTimestep : FixedTimestepBase
+{
+	static_assert(Num > 0 && Den > 0 && MaxSteps > 0, "Timestep and step limit must be non-zero.");
+	static constexpr double fixedStep = double(Num) / double(Den);
+	static constexpr uint64_t maxSteps = MaxSteps;
+};
+
+template <typename T>
+constexpr bool hasRunRate()
+{
+	return isSystem<T>() && std::is_base_of<RunRateBase, T>::value;
+}
+
+template <typename T>
+constexpr bool hasFixedTimestep()
+{
+	return isSystem<T>() && std::is_base_of<FixedTimestepBase, T>::value;
+}
+
+template <typename Sys>
+using SystemAccesses = Flatten<tuple_utils::Difference<typename Sys::Cont, Filter<typename Sys::Cont, DependencyBase>>>;
+// using SystemAccesses = Flatten<tuple_union<Filter<typename Sys::Cont, ReaderBase>, Filter<typename Sys::Cont, WriterBase>, Filter<typename Sys::Cont, OrchestratorBase>>>;
+
+template <typename A, typename B>
+constexpr bool exclusiveWith();
+
+template <typename Sys>
+struct CommittedReadCheck
+{
+	template <typename Value>
+	static constexpr bool callback()
+	{
+		return isBuffered<Value>() && !canWrite<Sys, Value>();
+	}
+};
+
+// Whether Sys reads the committed copy of a Buffered component.
+template <typename Sys>
+constexpr bool readsCommitted()
+{
+	return tuple_utils::OncePerType<SystemAccesses<Sys>, CommittedReadCheck<Sys>>::constFn();
+}
+
+// #####################
+// Architectures
+// #####################
+
+template <typename Arch, typename Entity>
+struct EntityId
+{
+private:
+	friend VirtualArchitecture;
+	uint64_t id;
+
+	EntityId(uint64_t id)
+	{
+		this->id = id;
+	}
+};
+
+struct VirtualArchitecture
+{
+protected:
+	template<typename Entity>
+	static void setEntityId(Entity* ent, uint64_t id)
+	{
+		ent->setGuid(Guid(id));
+	}
+
+	template<typename Entity>
+	static uint64_t getEntityId(const Entity* ent)
+	{
+		return ent->getGuid().get();
+	}
+
+	template <typename Arch, typename Entity>
+	static EntityId<Arch, Entity> getEntityId(const Entity* ent)
+	{
+		return EntityId<Arch, Entity>(VirtualArchitecture::getEntityId(ent));
+	}
+
+	template <typename Arch, typename Entity>
+	static uint64_t getEntityId(EntityId<Arch, Entity> key)
+	{
+		return key.id;
+	}
+};
+
+// Timings of a system in one frame, in nanoseconds since the frame began
+struct SystemTimes
+{
+	// Times it ran, 0 if it wasn't due
+	uint64_t runs = 0;
+	// When the last system it depends on finished
+	uint64_t ready = 0;
+	// When a worker picked up its task
+	uint64_t picked = 0;
+	// When its dependencies were done and it started running
+	uint64_t start = 0;
+	uint64_t end = 0;
+	// Time blocked on dependency barriers
+	uint64_t waited = 0;
+};
+
+template <typename Arch>
+struct RunTaskData
+{
+	Arch* arch;
+	Backend::Barrier* barriers;
+	uint64_t id;
+	// Times each system runs this frame, see Runner::runFrame
+	const uint64_t* repeats = nullptr;
+	// Timings of the systems to fill in, see Runner::FrameStats
+	SystemTimes* times = nullptr;
+};
+
+// #####################
+// Coroutines
+// #####################
+
+#ifdef CZSS_COROUTINES
+
+/* Coroutine systems
+	A system whose run returns SystemTask is a coroutine:
+
+	static SystemTask run(Accessor<Arch, Sys>& arch)
+	{
+		auto data = co_await loader->future;
+		co_await czss::wait(&barrier);
+	}
+
+	The system counts as running until the coroutine returns, so dependants
+	and exclusive systems stay blocked across suspension points. While it's
+	suspended the task running it waits on a backend barrier, which parks
+	the fiber under czsf and lets another pool worker take over under
+	ThreadPool.
+*/
+struct SystemTask
+{
+	struct promise_type;
+	using Handle = std::coroutine_handle<promise_type>;
+
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(Handle handle) noexcept { handle.promise().done->signal(); }
+		void await_resume() const noexcept { }
+	};
+
+	struct promise_type
+	{
+		Backend::Barrier* done = nullptr;
+
+		SystemTask get_return_object() { return SystemTask(Handle::from_promise(*this)); }
+		std::suspend_always initial_suspend() const noexcept { return {}; }
+		FinalAwaiter final_suspend() const noexcept { return {}; }
+		void return_void() const { }
+		void unhandled_exception() const { std::terminate(); }
+	};
+
+	SystemTask(const SystemTask&) = delete;
+	SystemTask& operator=(const SystemTask&) = delete;
+
+	SystemTask(SystemTask&& other) : handle(other.handle)
+	{
+		other.handle = nullptr;
+	}
+
+	~SystemTask()
+	{
+		if (handle)
+			handle.destroy();
+	}
+
+	// Runs the coroutine until it returns, waiting on a barrier while
+	// it's suspended.
+	void run()
+	{
+		Backend::Barrier done(1);
+		handle.promise().done = &done;
+		handle.resume();
+		done.wait();
+	}
+
+private:
+	SystemTask(Handle handle) : handle(handle) { }
+	Handle handle;
+};
+
+// Awaitable returned by wait(), resumes the coroutine on a backend task once
+// the barrier is signaled.
+struct BarrierAwaiter
+{
+	bool await_ready() const { return false; }
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		this->handle = handle;
+		Backend::run(resume, this, 1, nullptr);
+	}
+
+	void await_resume() const { }
+
+private:
+	friend BarrierAwaiter wait(Backend::Barrier* barrier);
+	BarrierAwaiter(Backend::Barrier* barrier) : barrier(barrier) { }
+
+	static void resume(BarrierAwaiter* awaiter)
+	{
+		auto handle = awaiter->handle;
+		awaiter->barrier->wait();
+		handle.resume();
+	}
+
+	Backend::Barrier* barrier;
+	std::coroutine_handle<> handle;
+};
+
+inline BarrierAwaiter wait(Backend::Barrier* barrier)
+{
+	return BarrierAwaiter(barrier);
+}
+
+// Single-use value handed from any thread, e.g. an IO thread, to a
+// coroutine system. Awaiting a future that isn't set yet suspends the
+// coroutine without occupying a task; set() schedules its resumption.
+template <typename T>
+struct Future
+{
+	Future() = default;
+	Future(const Future&) = delete;
+	Future& operator=(const Future&) = delete;
+
+	void set(T value)
+	{
+		this->value = std::move(value);
+		if (state.exchange(READY, std::memory_order_acq_rel) == WAITING)
+			Backend::run(resume, this, 1, nullptr);
+	}
+
+	bool ready() const
+	{
+		return state.load(std::memory_order_acquire) == READY;
+	}
+
+	bool await_ready() const
+	{
+		return ready();
+	}
+
+	bool await_suspend(std::coroutine_handle<> handle)
+	{
+		this->handle = handle;
+		uint32_t expected = EMPTY;
+		return state.compare_exchange_strong(expected, WAITING, std::memory_order_acq_rel);
+	}
+
+	T await_resume()
+	{
+		return std::move(value);
+	}
+
+private:
+	static constexpr uint32_t EMPTY = 0;
+	static constexpr uint32_t WAITING = 1;
+	static constexpr uint32_t READY = 2;
+
+	static void resume(Future* future)
+	{
+		future->handle.resume();
+	}
+
+	std::atomic<uint32_t> state { EMPTY };
+	std::coroutine_handle<> handle;
+	T value;
+};
+
+#endif // CZSS_COROUTINES
+
+// Calls a system function, running it to completion if it's a coroutine.
+template <typename F, typename A>
+inline void invokeSystem(F fn, A& accessor)
+{
+#ifdef CZSS_COROUTINES
+	CZSS_CONST_IF (std::is_same<decltype(fn(accessor)), SystemTask>::value)
+		fn(accessor).run();
+	else
+#endif
+		fn(accessor);
+}
+
+template <typename Arch>
+struct PipelineTaskData
+{
+	Arch* arch;
+	Backend::Barrier* barriers;
+	// Barriers of the previous frame, nullptr for the first frame
+	Backend::Barrier* previous;
+	// Signaled once the task no longer refers to previous
+	Backend::Barrier* released;
+	uint64_t id;
+};
+
+template <typename Arch, typename Subset>
+struct Runner
+{
+	static constexpr uint64_t sysCount = numUniques<Subset, SystemBase>();
+
+	template <typename Sys>
+	struct SystemBlocker
+	{
+		template <typename Value>
+		inline static void callback(Backend::Barrier* barriers)
+		{
+			CZSS_CONST_IF (directlyDependsOn<Sys, Value>() && !transitivelyDependsOn<Sys, Value>())
+			{
+				barriers[indexOf<Subset, Value, SystemBase>()].wait();
+			}
+		}
+	};
+
+	template <typename Sys>
+	struct DependeeBlocker
+	{
+		template <typename Value>
+		inline static void callback(Backend::Barrier* barriers)
+		{
+			CZSS_CONST_IF (directlyDependsOn<Value, Sys>() && !transitivelyDependsOn<Value, Sys>())
+			{
+				barriers[indexOf<Subset, Value, SystemBase>()].wait();
+			}
+		}
+	};
+
+	// Waits on the dependencies of Sys that run this frame, and on behalf of
+	// the skipped ones, on what they would have waited for.
+	template <typename Sys>
+	struct ScheduledSystemBlocker
+	{
+		template <typename Value>
+		inline static void callback(Backend::Barrier* barriers, const uint64_t* repeats)
+		{
+			CZSS_CONST_IF (directlyDependsOn<Sys, Value>() && !transitivelyDependsOn<Sys, Value>())
+			{
+				static constexpr uint64_t index = indexOf<Subset, Value, SystemBase>();
+				if (repeats[index] > 0)
+					barriers[index].wait();
+				else
+					tuple_utils::OncePerType<Subset, ScheduledSystemBlocker<Value>>::fn(barriers, repeats);
+			}
+		}
+	};
+
+	template <typename Sys>
+	struct PreviousFrameBlocker
+	{
+		template <typename Value>
+		inline static void callback(Backend::Barrier* previous)
+		{
+			CZSS_CONST_IF (std::is_same<Sys, Value>() || exclusiveWith<Sys, Value>())
+			{
+				previous[indexOf<Subset, Value, SystemBase>()].wait();
+			}
+		}
+	};
+
+	template <typename Value>
+	inline static void runSystem(Arch* arch)
+	{
+#ifdef CZSS_TIMING_BEGIN
+		CZSS_TIMING_BEGIN<Arch, Value>(arch);
+#endif
+#ifdef CZSS_BACKEND_THREAD_POOL
+		CZSS_PROFILE_SCOPE(czss::name<Value>(), "system", Arch::template absoluteIndex<Value>());
+#else
+		CZSS_PROFILE_ASYNC_SCOPE(czss::name<Value>(), "system", Arch::template absoluteIndex<Value>());
+#endif
+		CZSS_PERF_SCOPE(Arch, Value);
+		CZSS_ALLOC_SCOPE(Arch, Value);
+		Accessor<Arch, Value> accessor(arch);
+		invokeSystem(Value::run, accessor);
+
+#ifdef CZSS_TIMING_END
+		CZSS_TIMING_END<Arch, Value>(arch);
+#endif
+	}
+
+	struct SystemRunner
+	{
+		template <typename Value>
+		inline static void callback(uint64_t* id, Backend::Barrier* barriers, Arch* arch)
+		{
+			tuple_utils::OncePerType<Subset, SystemBlocker<Value>>::fn(barriers);
+			runSystem<Value>(arch);
+			barriers[*id].signal();
+		}
+	};
+
+	struct ScheduledSystemRunner
+	{
+		template <typename Value>
+		inline static void callback(uint64_t* id, Backend::Barrier* barriers, Arch* arch, const uint64_t* repeats, SystemTimes* times)
+		{
+			uint64_t picked = times != nullptr ? nanoTime() : 0;
+			tuple_utils::OncePerType<Subset, ScheduledSystemBlocker<Value>>::fn(barriers, repeats);
+			uint64_t start = times != nullptr ? nanoTime() : 0;
+
+			for (uint64_t i = 0; i < repeats[*id]; i++)
+				runSystem<Value>(arch);
+
+			if (times != nullptr)
+				times[*id] = { repeats[*id], 0, picked, start, nanoTime(), start - picked };
+			barriers[*id].signal();
+		}
+	};
+
+	struct PipelinedSystemRunner
+	{
+		template <typename Value>
+		inline static void callback(PipelineTaskData<Arch>* data)
+		{
+			if (data->previous != nullptr)
+				tuple_utils::OncePerType<Subset, PreviousFrameBlocker<Value>>::fn(data->previous);
+			data->released->signal();
+
+			tuple_utils::OncePerType<Subset, SystemBlocker<Value>>::fn(data->barriers);
+			runSystem<Value>(data->arch);
+			data->barriers[data->id].signal();
+		}
+	};
+
+	struct SystemInitialize
+	{
+		template <typename Value>
+		inline static void callback(const uint64_t* id, Backend::Barrier* barriers, Arch* arch)
+		{
+			tuple_utils::OncePerType<Subset, SystemBlocker<Value>>::fn(barriers);
+			Accessor<Arch, Value> accessor(arch);
+			Value::initialize(accessor);
+			barriers[*id].signal();
+		}
+	};
+
+	struct SystemShutdown
+	{
+		template <typename Value>
+		inline static void callback(uint64_t* id, Backend::Barrier* barriers, Arch* arch)
+		{
+			tuple_utils::OncePerType<Subset, DependeeBlocker<Value>>::fn(barriers);
+			Accessor<Arch, Value> accessor(arch);
+			Value::shutdown(accessor);
+			barriers[*id].signal();
+		}
+	};
+
+	static void systemCallback(RunTaskData<Arch>* data)
+	{
+		tuple_utils::Switch<Subset>::template fn<SystemRunner>(data->id, &data->id, data->barriers, data->arch);
+	}
+
+	static void initializeSystemCallback(RunTaskData<Arch>* data)
+	{
+		tuple_utils::Switch<Subset>::template fn<SystemInitialize>(data->id, &data->id, data->barriers, data->arch);
+	}
+
+	static void shutdownSystemCallback(RunTaskData<Arch>* data)
+	{ 
+		tuple_utils::Switch<Subset>::template fn<SystemShutdown>(data->id, &data->id, data->barriers, data->arch);
+	}
+
+	static void scheduledSystemCallback(RunTaskData<Arch>* data)
+	{
+		tuple_utils::Switch<Subset>::template fn<ScheduledSystemRunner>(data->id, &data->id, data->barriers, data->arch, data->repeats, data->times);
+	}
+
+	static void pipelinedSystemCallback(PipelineTaskData<Arch>* data)
+	{
+		tuple_utils::Switch<Subset>::template fn<PipelinedSystemRunner>(data->id, data);
+	}
+
+	struct FrameClock
+	{
+		uint64_t frame = 0;
+		double accumulators[sysCount] = {};
+	};
+
+	// Where the time of a frame run by runFrame went, for tuning Dependency
+	// and permission declarations. Times are in nanoseconds since the frame
+	// began.
+	struct FrameStats
+	{
+		uint64_t frame = 0;
+		uint64_t duration = 0;
+		SystemTimes systems[sysCount];
+		// Time each backend worker spent without a task during the frame,
+		// empty if the backend doesn't report it
+		std::vector<uint64_t> workerIdle;
+		// Systems from the first to the last to finish, each the dependency
+		// of the next that finished last. Systems on it serialise the frame.
+		std::vector<uint64_t> criticalPath;
+		// Heap allocations by any thread during the frame, counted with
+		// CZSS_ALLOC_COUNTERS
+		uint64_t allocations = 0;
+
+		static const char* systemName(uint64_t system)
+		{
+			const char* name = nullptr;
+			tuple_utils::Switch<Subset>::template fn<NameGetter>(system, &name);
+			return name;
+		}
+
+		// Table of the system timings, the critical path and worker idle time
+		std::string report() const
+		{
+			char line[256];
+			std::string out;
+			auto ms = [] (uint64_t ns) { return ns / 1e6; };
+
+			uint64_t ran = 0;
+			for (const SystemTimes& s : systems)
+				ran += s.runs > 0 ? 1 : 0;
+
+			snprintf(line, sizeof(line), "Frame %llu: %.3f ms, %llu of %llu systems ran\n",
+				static_cast<unsigned long long>(frame), ms(duration), static_cast<unsigned long long>(ran), static_cast<unsigned long long>(sysCount));
+			out += line;
+			snprintf(line, sizeof(line), "%-24s %10s %10s %10s %10s %10s\n", "system (ms)", "ready", "start", "end", "waited", "delayed");
+			out += line;
+
+			for (uint64_t i = 0; i < sysCount; i++)
+			{
+				const SystemTimes& s = systems[i];
+				if (s.runs == 0)
+					continue;
+
+				snprintf(line, sizeof(line), "%-24.24s %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+					systemName(i), ms(s.ready), ms(s.start), ms(s.end), ms(s.waited), ms(s.start > s.ready ? s.start - s.ready : 0));
+				out += line;
+			}
+
+			uint64_t serial = 0;
+			for (uint64_t i : criticalPath)
+				serial += systems[i].end - systems[i].start;
+
+			snprintf(line, sizeof(line), "Critical path: %.3f ms running, %.0f%% of the frame\n",
+				ms(serial), duration > 0 ? 100.0 * serial / duration : 0.0);
+			out += line;
+
+			for (uint64_t i : criticalPath)
+			{
+				snprintf(line, sizeof(line), "  %-24.24s ran %.3f ms after a delay of %.3f ms\n",
+					systemName(i), ms(systems[i].end - systems[i].start), ms(systems[i].start - min(systems[i].start, systems[i].ready)));
+				out += line;
+			}
+
+			if (!workerIdle.empty())
+			{
+				out += "Worker idle (ms):";
+				for (uint64_t idle : workerIdle)
+				{
+					snprintf(line, sizeof(line), " %.3f", ms(idle));
+					out += line;
+				}
+				out += "\n";
+			}
+
+#ifdef CZSS_ALLOC_COUNTERS
+			snprintf(line, sizeof(line), "Allocations: %llu\n", static_cast<unsigned long long>(allocations));
+			out += line;
+#endif
+
+			return out;
+		}
+
+	private:
+		friend Runner;
+		uint64_t begin = 0;
+		uint64_t allocationsBegin = 0;
+
+		struct NameGetter
+		{
+			template <typename Value>
+			inline static void callback(const char** name)
+			{
+				*name = czss::name<Value>();
+			}
+		};
+
+		void start()
+		{
+			begin = nanoTime();
+			for (SystemTimes& s : systems)
+				s = SystemTimes();
+
+			workerIdle.resize(Backend::workerCount());
+			for (uint32_t w = 0; w < workerIdle.size(); w++)
+				workerIdle[w] = Backend::idleTime(w);
+
+#ifdef CZSS_ALLOC_COUNTERS
+			allocationsBegin = AllocCounters::total();
+#endif
+		}
+
+		void finish(uint64_t frame)
+		{
+			this->frame = frame;
+			duration = nanoTime() - begin;
+#ifdef CZSS_ALLOC_COUNTERS
+			allocations = AllocCounters::total() - allocationsBegin;
+#endif
+
+			// Workers started during the frame count from their start
+			workerIdle.resize(Backend::workerCount(), 0);
+			for (uint32_t w = 0; w < workerIdle.size(); w++)
+			{
+				uint64_t idle = Backend::idleTime(w);
+				workerIdle[w] = idle > workerIdle[w] ? idle - workerIdle[w] : 0;
+			}
+
+			for (SystemTimes& s : systems)
+			{
+				if (s.runs > 0)
+				{
+					s.picked -= begin;
+					s.start -= begin;
+					s.end -= begin;
+				}
+			}
+
+			// The dependency that finished last held a system back, and so
+			// on back to a system that waited on none.
+			static constexpr auto deps = dependencies(std::make_index_sequence<sysCount>());
+			uint64_t last = sysCount;
+			for (uint64_t i = 0; i < sysCount; i++)
+			{
+				for (uint64_t j = 0; j < sysCount; j++)
+				{
+					if (deps[i][j] && systems[j].runs > 0)
+						systems[i].ready = max(systems[i].ready, systems[j].end);
+				}
+
+				if (systems[i].runs > 0 && (last == sysCount || systems[i].end > systems[last].end))
+					last = i;
+			}
+
+			criticalPath.clear();
+			for (uint64_t i = last; i < sysCount; )
+			{
+				criticalPath.push_back(i);
+				uint64_t previous = sysCount;
+				for (uint64_t j = 0; j < sysCount; j++)
+				{
+					if (deps[i][j] && systems[j].runs > 0 && (previous == sysCount || systems[j].end > systems[previous].end))
+						previous = j;
+				}
+				i = previous;
+			}
+			std::reverse(criticalPath.begin(), criticalPath.end());
+		}
+
+		template <size_t I, size_t ...J>
+		static constexpr std::array<bool, sysCount> dependenciesOf(std::index_sequence<J...>)
+		{
+			return {{ dependsOn<
+				typename std::tuple_element<I, Subset>::type,
+				typename std::tuple_element<J, Subset>::type>()... }};
+		}
+
+		// deps[I][J] is set when system I depends on system J, directly or not
+		template <size_t ...I>
+		static constexpr std::array<std::array<bool, sysCount>, sysCount> dependencies(std::index_sequence<I...> seq)
+		{
+			return {{ dependenciesOf<I>(seq)... }};
+		}
+	};
+
+	struct StepCounter
+	{
+		template <typename Value>
+		inline static void callback(FrameClock* clock, const double& dt, uint64_t* repeats)
+		{
+			static constexpr uint64_t index = indexOf<Subset, Value, SystemBase>();
+			bool due = true;
+
+			CZSS_CONST_IF (hasRunRate<Value>())
+			{
+				due = clock->frame % Value::runPeriod == Value::runPhase;
+			}
+
+			uint64_t steps = due ? 1 : 0;
+
+			// Time keeps accumulating over frames the system sits out and is
+			// spent on the next frame it runs.
+			CZSS_CONST_IF (hasFixedTimestep<Value>())
+			{
+				double& accumulator = clock->accumulators[index];
+				accumulator += dt;
+				if (due)
+				{
+					steps = uint64_t(accumulator / Value::fixedStep);
+					if (steps > Value::maxSteps)
+					{
+						steps = Value::maxSteps;
+						accumulator = 0;
+					}
+					else
+					{
+						accumulator -= steps * Value::fixedStep;
+					}
+				}
+			}
+
+			repeats[index] = steps;
+		}
+	};
+
+	template <typename T>
+	static void runForSystems(Arch* arch, void (*fn)(RunTaskData<Arch>*), T* fls)
+	{
+		Backend::Activity activity;
+		Backend::Barrier barriers[sysCount];
+		RunTaskData<Arch> taskData[sysCount];
+
+		for (uint64_t i = 0; i < sysCount; i++)
+		{
+			barriers[i].setValue(1);
+			taskData[i].arch = arch;
+			taskData[i].barriers = barriers;
+			taskData[i].id = i;
+		}
+
+		Backend::Barrier wait(sysCount);
+		if (fls == nullptr)
+			Backend::run(fn, taskData, sysCount, &wait);
+		else
+			Backend::run(fls, fn, taskData, sysCount, &wait);
+		wait.wait();
+		arch->publishConcurrentEntities();
+		arch->commitBuffers();
+	}
+
+	// Runs one frame of the systems due on it, advancing the clock by dt
+	// seconds. Only due systems get a task; dependencies on skipped systems
+	// resolve to the skipped systems' own dependencies. Fills stats when
+	// given.
+	static void runFrame(Arch* arch, FrameClock* clock, double dt, FrameStats* stats = nullptr)
+	{
+		Backend::Activity activity;
+		Backend::Barrier barriers[sysCount];
+		RunTaskData<Arch> taskData[sysCount];
+		uint64_t repeats[sysCount];
+
+		if (stats != nullptr)
+			stats->start();
+
+		tuple_utils::OncePerType<Subset, StepCounter>::fn(clock, dt, repeats);
+		clock->frame++;
+
+		uint64_t count = 0;
+		for (uint64_t i = 0; i < sysCount; i++)
+		{
+			barriers[i].setValue(repeats[i] > 0 ? 1 : 0);
+			if (repeats[i] == 0)
+				continue;
+
+			taskData[count].arch = arch;
+			taskData[count].barriers = barriers;
+			taskData[count].id = i;
+			taskData[count].repeats = repeats;
+			taskData[count].times = stats != nullptr ? stats->systems : nullptr;
+			count++;
+		}
+
+		if (count > 0)
+		{
+			Backend::Barrier wait(count);
+			Backend::run(scheduledSystemCallback, taskData, count, &wait);
+			wait.wait();
+			arch->publishConcurrentEntities();
+			arch->commitBuffers();
+		}
+
+		if (stats != nullptr)
+			stats->finish(clock->frame - 1);
+	}
+
+	// Runs frames without a barrier between them. A system of frame N + 1
+	// starts once its dependencies in frame N + 1 and the systems it's
+	// exclusive with in frame N have finished, so at most two frames are in
+	// flight. submit() blocks until frame N - 1 is no longer needed.
+	// Frames never all finish at once, so there's no point to commit Buffered
+	// components at and systems reading their committed copy can't run here.
+	struct Pipeline
+	{
+		struct CommittedReaderCheck
+		{
+			template <typename Value>
+			static constexpr bool callback()
+			{
+				return readsCommitted<Value>();
+			}
+		};
+
+		static_assert(!tuple_utils::OncePerType<Subset, CommittedReaderCheck>::constFn(),
+			"Pipelined systems can't read the committed copy of a Buffered component.");
+
+		Pipeline(Arch* arch) : arch(arch) { }
+
+		Pipeline(const Pipeline&) = delete;
+		Pipeline& operator=(const Pipeline&) = delete;
+
+		~Pipeline()
+		{
+			drain();
+		}
+
+		void submit()
+		{
+			Frame& current = frames[frame % 2];
+			Frame& previous = frames[(frame + 1) % 2];
+
+			// Tasks of the previous frame may still wait on the barriers
+			// about to be reset.
+			if (current.inFlight)
+			{
+				current.done.wait();
+				Backend::endActivity();
+			}
+			if (previous.inFlight)
+				previous.released.wait();
+
+			current.done.setValue(sysCount);
+			current.released.setValue(sysCount);
+
+			for (uint64_t i = 0; i < sysCount; i++)
+			{
+				current.barriers[i].setValue(1);
+				current.taskData[i].arch = arch;
+				current.taskData[i].barriers = current.barriers;
+				current.taskData[i].previous = previous.inFlight ? previous.barriers : nullptr;
+				current.taskData[i].released = &current.released;
+				current.taskData[i].id = i;
+			}
+
+			current.inFlight = true;
+			frame++;
+			Backend::beginActivity();
+			Backend::run(pipelinedSystemCallback, current.taskData, sysCount, &current.done);
+		}
+
+		// Waits for every submitted frame to finish.
+		void drain()
+		{
+			for (Frame& f : frames)
+			{
+				if (f.inFlight)
+				{
+					f.done.wait();
+					Backend::endActivity();
+				}
+				f.inFlight = false;
+			}
+
+			arch->publishConcurrentEntities();
+		}
+
+		uint64_t submitted() const
+		{
+			return frame;
+		}
+
+	private:
+		struct Frame
+		{
+			Backend::Barrier barriers[sysCount];
+			Backend::Barrier done;
+			Backend::Barrier released;
+			PipelineTaskData<Arch> taskData[sysCount];
+			bool inFlight = false;
+		};
+
+		Arch* arch;
+		Frame frames[2];
+		uint64_t frame = 0;
+	};
+};
+
+template <template<typename...> class T, typename ...Values>
+struct RewrapImpl;
+
+template <template<typename...> class T, typename ...Values>
+struct RewrapImpl<T, std::tuple<Values...>>
+{
+	using type = T<Values...>;
+};
+
+template <template<typename...> class T, typename ...Values>
+using Rewrap = typename RewrapImpl<T, Values...>::type;
+
+template <typename Entity, typename Accessor>
+void onCreate(Entity& entity, Accessor& accessor) {};
+
+template <typename Component, typename Entity, typename Accessor>
+void onCreate(Component& component, Entity& entity, Accessor& accessor) {};
+
+template <typename Entity, typename Accessor, typename Context>
+void onCreate(Entity& entity, Accessor& accessor, const Context& context) {};
+
+template <typename Component, typename Entity, typename Accessor, typename Context>
+void onCreate(Component& component, Entity& entity, Accessor& accessor, const Context& context) {};
+
+template <typename Entity, typename Accessor>
+void onDestroy(Entity& entity, Accessor& accessor) {};
+
+template <typename Component, typename Entity, typename Accessor>
+void onDestroy(Component& component, Entity& entity, Accessor& accessor) {};
+
+template <typename Desc, typename ...Contents>
+struct Architecture : VirtualArchitecture
+{
+	using Cont = tuple_utils::Set<Contents...>;
+	using This = Architecture<Desc, Contents...>;
+	using OmniSystem = System <
+		Rewrap<Orchestrator, Filter<Cont, EntityBase>>,
+		Rewrap<Writer, Filter<Cont, ComponentBase>>,
+		Rewrap<Writer, Filter<Cont, ResourceBase>>
+	>;
+
+	Accessor<Desc, OmniSystem> accessor()
+	{
+		return Accessor<Desc, OmniSystem>(reinterpret_cast<Desc*>(this));
+	}
+
+	static constexpr uint64_t numEntities() { return numUniques<Cont, EntityBase>(); }
+
+	template<typename Entity>
+	static constexpr uint64_t entityIndex()
+	{
+		return isEntity<Entity>() ? indexOf<Cont, Entity, EntityBase>() : -1;
+	}
+
+	template <typename Resource>
+	void setResource(Resource* res)
+	{
+		static_assert(isResource<Resource>(), "Template parameter must be a Resource.");
+		static_assert(inspect::contains<Cont, Resource>(), "Architecture doesn't contain Resource.");
+		static constexpr uint64_t INDEX = indexOf<Cont, Resource, ResourceBase>();
+		std::get<tuple_utils::Index<Resource*, RewrapElements<std::add_pointer, Filter<Cont, ResourceBase>>>::value>(resources) = res;
+	}
+
+	template <typename Alloc>
+	struct ResourceInitializer
+	{
+		template <typename R>
+		static void callback(This* arch, Alloc& alloc)
+		{
+			typedef typename std::allocator_traits<Alloc>::template rebind_alloc<R> ralloc;
+			using traits = std::allocator_traits<ralloc>;
+			auto a = ralloc(alloc);
+			auto p = traits::allocate(a, 1);
+			traits::construct(a, p);
+			arch->setResource(p);
+		}
+	};
+
+	template <typename Alloc>
+	struct ResourceDestructor
+	{
+		template <typename R>
+		static void callback(This* arch, Alloc& alloc)
+		{
+			typedef typename std::allocator_traits<Alloc>::template rebind_alloc<R> ralloc;
+			using traits = std::allocator_traits<ralloc>;
+			auto a = ralloc(alloc);
+			auto p = arch->template getResource<R>();
+			traits::destroy(a, p);
+			traits::deallocate(a, p, 1);
+		}
+	};
+
+	template <typename T, typename Alloc>
+	void initializeResources(Alloc& alloc)
+	{
+		tuple_utils::OncePerType<T, ResourceInitializer<Alloc>>::fn(this, alloc);
+	}
+
+	template <typename Alloc>
+	void initializeResources(Alloc& alloc)
+	{
+		using _r = Filter<Cont, ResourceBase>;
+		this->initializeResources<_r, Alloc>(alloc);
+	}
+
+	template <typename T, typename Alloc>
+	void freeResources(Alloc& alloc)
+	{
+		tuple_utils::OncePerType<T, ResourceDestructor<Alloc>>::fn(this, alloc);
+	}
+
+	template <typename Alloc>
+	void freeResources(Alloc& alloc)
+	{
+		using _r = Filter<Cont, ResourceBase>;
+		this->freeResources<_r, Alloc>(alloc);
+	}
+
+	template <typename Resource>
+	Resource* getResource()
+	{
+		static_assert(isResource<Resource>(), "Template parameter must be a Resource.");
+		static_assert(inspect::contains<Cont, Resource>(), "Architecture doesn't contain Resource.");
+		return std::get<tuple_utils::Index<Resource*, RewrapElements<std::add_pointer, Filter<Cont, ResourceBase>>>::value>(resources);
+	}
+
+	template <typename Entity>
+	EntityStore<Entity>* getEntities()
+	{
+		static_assert(inspect::contains<Cont, Entity>(), "Architecture doesn't contain the entity.");
+		// assert(isEntity<Entity>());
+		return &std::get<tuple_utils::Index<EntityStore<Entity>, RewrapElements<EntityStore, Filter<Cont, EntityBase>>>::value>(entities);
+	}
+
+	template <typename Category>
+	static const char* name(uint64_t id)
+	{
+		static const char* d = "Unknown";
+		const char** result = &d;
+		tuple_utils::OncePerType<Cont, NameFinder<Category>>::fn(id, result);
+		return *result;
+	}
+
+	void* getEntity(Guid guid)
+	{
+		void* ret = nullptr;
+		dispatchGuid<GetEntityVoidPtr, Filter<Cont, EntityBase>>(guid, ret);
+		return ret;
+	}
+
+	template <typename Entity>
+	Entity* getEntity(Guid guid)
+	{
+		return indexOf<Cont, Entity, EntityBase>() == typeKey(guid)
+			? getEntity<Entity>(guidId(guid))
+			: nullptr;
+	}
+
+	template <typename Entity>
+	Entity* getEntity(uint64_t id)
+	{
+		return getEntities<Entity>()->get(id);
+	}
+
+private:
+	template <typename System>
+	struct ResolveGuid
+	{
+		template <typename T, typename F>
+		static bool callback(This* arch, uint64_t id, F& f)
+		{
+			auto entity = arch->template getEntities<T>()->get(id);
+			if (entity == nullptr)
+				return false;
+
+			auto accessor = TypedEntityAccessor<System, T>(entity);
+			f(accessor);
+			return true;
+		}
+	};
+
+	template <typename System, typename Component>
+	struct AccessComponent
+	{
+		template <typename T, typename F>
+		static bool callback(This* arch, uint64_t id, F& f)
+		{
+			auto entity = arch->template getEntities<T>()->get(id);
+			if (entity == nullptr)
+				return false;
+
+			auto accessor = TypedEntityAccessor<System, T>(entity);
+			f(accessor.template getComponent<Component>());
+			return true;
+		}
+	};
+
+	// Entry of the types a Guid lookup excludes
+	struct UnresolvedGuid
+	{
+		template <typename T, typename ...Params>
+		static bool callback(This*, uint64_t, Params&...)
+		{
+			return false;
+		}
+	};
+
+	// Callbacks of a Guid lookup indexed by type key, types outside Set
+	// get UnresolvedGuid.
+	template <typename Resolver, typename Set, typename ...Params>
+	struct GuidTable
+	{
+		using Entities = Filter<Cont, EntityBase>;
+		using Fn = bool (*)(This*, uint64_t, Params&...);
+		static constexpr size_t N = std::tuple_size<Entities>::value;
+
+		template <typename T>
+		using Entry = typename std::conditional<inspect::contains<Set, T>(), Resolver, UnresolvedGuid>::type;
+
+		template <size_t ...I>
+		static constexpr std::array<Fn, N> make(std::index_sequence<I...>)
+		{
+			return {{ &Entry<typename std::tuple_element<I, Entities>::type>::template callback<typename std::tuple_element<I, Entities>::type>... }};
+		}
+
+		static constexpr std::array<Fn, N> table = make(std::make_index_sequence<N>());
+	};
+
+	// Resolves a Guid with one indexed call instead of testing every
+	// entity type, returns false if it doesn't refer to a live entity of Set.
+	template <typename Resolver, typename Set, typename ...Params>
+	bool dispatchGuid(Guid guid, Params&... params)
+	{
+		return dispatchTypeKey<Resolver, Set>(typeKey(guid), guidId(guid), params...);
+	}
+
+	template <typename Resolver, typename Set, typename ...Params>
+	bool dispatchTypeKey(uint64_t key, uint64_t id, Params&... params)
+	{
+		static constexpr auto& table = GuidTable<Resolver, Set, Params...>::table;
+		return key < table.size() && table[key](this, id, params...);
+	}
+
+	// Guid id with its sort key, the type key above the slot, i.e. the low
+	// 32 bits of the id of non-virtual entities.
+	struct SortedGuid
+	{
+		uint64_t order;
+		uint64_t id;
+	};
+
+	static constexpr uint64_t BUCKET_BITS = 12;
+
+	// Buckets the Guids by the top BUCKET_BITS bits of their sort key in a
+	// single counting pass. That groups them by type and, within a type, by
+	// ranges of slots small enough to stay in cache, where the order no
+	// longer matters. A full sort costs more than the misses it saves.
+	static std::vector<SortedGuid> sortGuids(std::span<const Guid> guids, uint64_t& slotBits)
+	{
+		static constexpr uint64_t buckets = uint64_t(1) << BUCKET_BITS;
+		std::vector<SortedGuid> keys(guids.size());
+
+		uint64_t maxSlot = 0;
+		for (size_t i = 0; i < guids.size(); i++)
+		{
+			keys[i].id = guidId(guids[i]);
+			maxSlot = max(maxSlot, keys[i].id & 0xffffffff);
+		}
+
+		slotBits = std::bit_width(maxSlot);
+		uint64_t maxOrder = 0;
+		for (size_t i = 0; i < guids.size(); i++)
+		{
+			keys[i].order = (typeKey(guids[i]) << slotBits) | (keys[i].id & 0xffffffff);
+			maxOrder = max(maxOrder, keys[i].order);
+		}
+
+		uint64_t shift = max(uint64_t(std::bit_width(maxOrder)), BUCKET_BITS) - BUCKET_BITS;
+		std::vector<size_t> offsets(buckets + 1, 0);
+		for (const SortedGuid& key : keys)
+			offsets[(key.order >> shift) + 1]++;
+		for (uint64_t b = 1; b <= buckets; b++)
+			offsets[b] += offsets[b - 1];
+
+		std::vector<SortedGuid> sorted(guids.size());
+		for (const SortedGuid& key : keys)
+			sorted[offsets[key.order >> shift]++] = key;
+
+		return sorted;
+	}
+
+	// Calls f for the live entities of sorted Guids, a run of one type at a
+	// time. Returns how many were found.
+	template <typename Sys, typename F>
+	size_t accessSorted(const SortedGuid* sorted, size_t count, uint64_t slotBits, F& f)
+	{
+		size_t resolved = 0;
+		size_t end;
+		for (size_t begin = 0; begin < count; begin = end)
+		{
+			uint64_t key = sorted[begin].order >> slotBits;
+			for (end = begin + 1; end < count && sorted[end].order >> slotBits == key; end++);
+
+			const SortedGuid* run = sorted + begin;
+			dispatchTypeKey<AccessSortedRun<Sys>, Filter<Cont, EntityBase>>(key, end - begin, run, f, resolved);
+		}
+
+		return resolved;
+	}
+
+	// Entities are resolved and prefetched a block ahead of the calls
+	static constexpr size_t ACCESS_BLOCK = 64;
+
+	template <typename System>
+	struct AccessSortedRun
+	{
+		template <typename T, typename F>
+		static bool callback(This* arch, uint64_t count, const SortedGuid*& run, F& f, size_t& resolved)
+		{
+			auto entities = arch->template getEntities<T>();
+			T* block[ACCESS_BLOCK];
+
+			for (uint64_t begin = 0; begin < count; begin += ACCESS_BLOCK)
+			{
+				uint64_t n = min(count - begin, uint64_t(ACCESS_BLOCK));
+				for (uint64_t i = 0; i < n; i++)
+				{
+					block[i] = entities->get(run[begin + i].id);
+					CZSS_PREFETCH(block[i]);
+				}
+
+				for (uint64_t i = 0; i < n; i++)
+				{
+					if (block[i] == nullptr)
+						continue;
+
+					auto accessor = TypedEntityAccessor<System, T>(block[i]);
+					f(accessor);
+					resolved++;
+				}
+			}
+
+			return true;
+		}
+	};
+
+	template <typename ...Components>
+	struct ContainsAllComponentsFilter
+	{
+		template <typename Entity>
+		static constexpr bool test()
+		{
+			return inspect::containsAllIn<typename Entity::Cont, Filter<Flatten<std::tuple<Components...>>, ComponentBase>>();
+		}
+	};
+
+public:
+	template <typename Sys, typename F>
+	bool accessEntity(Guid guid, F f)
+	{
+		return dispatchGuid<ResolveGuid<Sys>, Filter<Cont, EntityBase>>(guid, f);
+	}
+
+	// Calls f with a TypedEntityAccessor for each of the Guids that refers
+	// to a live entity and returns how many did. The Guids are grouped by
+	// type and bucketed by slot first, so entities are visited roughly in
+	// memory order rather than the order of guids.
+	template <typename Sys, typename F>
+	size_t accessEntities(std::span<const Guid> guids, F f)
+	{
+		uint64_t slotBits;
+		auto sorted = sortGuids(guids, slotBits);
+		return accessSorted<Sys>(sorted.data(), sorted.size(), slotBits, f);
+	}
+
+	// As accessEntities, with the sorted Guids split evenly over numTasks
+	// tasks calling f(taskIndex, accessor). Entities listed more than once
+	// may be accessed by several tasks at the same time.
+	template <typename Sys, typename F>
+	size_t parallelAccessEntities(uint64_t numTasks, std::span<const Guid> guids, F f)
+	{
+		uint64_t slotBits;
+		auto sorted = sortGuids(guids, slotBits);
+		numTasks = max(uint64_t(1), min(numTasks, uint64_t(sorted.size())));
+		std::atomic<size_t> resolved { 0 };
+
+		runTasks(numTasks, [&](uint64_t task) {
+			size_t begin = sorted.size() * task / numTasks;
+			size_t end = sorted.size() * (task + 1) / numTasks;
+			auto g = [&](auto& accessor) { f(task, accessor); };
+			resolved += accessSorted<Sys>(sorted.data() + begin, end - begin, slotBits, g);
+		});
+
+		return resolved;
+	}
+
+	template <typename Sys, typename Component, typename F>
+	bool accessComponent(Guid guid,  F f)
+	{
+		using _entities = Filter<Cont, EntityBase>;
+		using _set = tuple_utils::Subset<_entities, ContainsAllComponentsFilter<Component>>;
+		return dispatchGuid<AccessComponent<Sys, Component>, _set>(guid, f);
+	}
+
+	template <typename Sys, typename F, typename ...Components>
+	bool accessEntityFiltered(Guid guid, F f)
+	{
+		using _entities = Filter<Cont, EntityBase>;
+		using _set = tuple_utils::Subset<_entities, ContainsAllComponentsFilter<Components...>>;
+		return dispatchGuid<ResolveGuid<Sys>, _set>(guid, f);
+	}
+
+private:
+	template <typename System, typename Entity>
+	void postInitializeEntity(Guid guid, Entity* ent)
+	{
+		setEntityId(ent, guid.get());
+		auto accessor = Accessor<Desc, System>(reinterpret_cast<Desc*>(this));
+		tuple_utils::OncePerType<typename Entity::Cont, OnCreateCallback>::fn(*ent, accessor);
+		onCreate(*ent, accessor);
+		ent->commitBuffered();
+	}
+
+	template <typename System, typename Entity, typename Context>
+	void postInitializeEntity(Guid guid, Entity* ent, const Context& context)
+	{
+		setEntityId(ent, guid.get());
+		auto accessor = Accessor<Desc, System>(reinterpret_cast<Desc*>(this));
+		tuple_utils::OncePerType<typename Entity::Cont, OnCreateContextCallback>::fn(*ent, accessor, context);
+		onCreate(*ent, accessor, context);
+		ent->commitBuffered();
+	}
+
+public:
+	template <typename Entity, typename System, typename ...Params>
+	Entity* createEntity(Params&&... params)
+	{
+		CZSS_CONST_IF (isEntity<Entity>())
+		{
+			auto ent = initializeEntity<Entity>(std::forward<Params>(params)...);
+			Guid guid = ent->getGuid();
+			postInitializeEntity<System>(guid, ent);
+			return ent;
+		}
+
+		return nullptr;
+	}
+
+	template <typename Entity, typename ...Params>
+	Entity* createEntity(Params&&... params)
+	{
+		return createEntity<Entity, OmniSystem>(std::forward(params)...);
+	}
+
+	template <typename Entity, typename System, typename Context, typename ...Params>
+	Entity* createEntityWithContext(const Context& context, Params&&... params)
+	{
+		CZSS_CONST_IF (isEntity<Entity>())
+		{
+			auto ent = initializeEntity<Entity>(std::forward<Params>(params)...);
+			Guid guid = ent->getGuid();
+			postInitializeEntity<System>(guid, ent, context);
+			return ent;
+		}
+
+		return nullptr;
+	}
+
+	template <typename Entity, typename Context, typename ...Params>
+	Entity* createEntityWithContext(const Context& context, Params&&... params)
+	{
+		return createEntityWithContext<Entity, OmniSystem>(context, std::forward(params)...);
+	}
+
+	// Creates the entity from any thread and runs its onCreate hooks right
+	// away. It's found by iteration and by Guid once published, see
+	// EntityStore::createConcurrent.
+	template <typename Entity, typename System, typename ...Params>
+	Entity* createEntityConcurrent(Params&&... params)
+	{
+		static_assert(isEntity<Entity>(), "Template parameter must be an Entity.");
+		static_assert(typeKeyLength() + EntityStore<Entity>::ID_BITS <= 63, "Too many entity types for the Guid layout.");
+
+		uint64_t id;
+		auto entities = getEntities<Entity>();
+		Entity* ent = entities->template createConcurrent<Entity>(id, std::forward<Params>(params)...);
+		id += entityIndex<Entity>() << 63 - typeKeyLength();
+		postInitializeEntity<System>(Guid(id), ent);
+		return ent;
+	}
+
+	// Publishes the entities created concurrently. Runner calls this once
+	// its systems are done, accessors after parallel sections for the types
+	// their system orchestrates.
+	void publishConcurrentEntities()
+	{
+		tuple_utils::OncePerType<Filter<Cont, EntityBase>, PublishConcurrentCallback>::fn(this);
+	}
+
+	template <typename Entity>
+	static Guid getEntityGuid(Entity* ent)
+	{
+		return Guid(VirtualArchitecture::getEntityId(ent)
+			+ (indexOf<Cont, Entity, EntityBase>()) << (63 - typeKeyLength()));
+	}
+
+	template <typename Entity>
+	static EntityId<Desc, Entity> getEntityId(Entity* ent)
+	{
+		return VirtualArchitecture::getEntityId<Desc, Entity>(ent);
+	}
+
+	template <typename System, typename Entity>
+	void destroyEntity(Entity& entity)
+	{
+		auto entities = getEntities<Entity>();
+		auto id = guidId(entity.getGuid());
+		auto accessor = Accessor<Desc, System>(reinterpret_cast<Desc*>(this));
+		tuple_utils::OncePerType<typename Entity::Cont, OnDestroyCallback>::fn(entity, accessor);
+		onDestroy(entity, accessor);
+		entities->destroy(id);
+	}
+
+	template <typename Entity>
+	void destroyEntity(Entity& entity)
+	{
+		destroyEntity<OmniSystem, Entity>(entity);
+	}
+
+	template <typename System, typename Entity>
+	void destroyEntity(uint64_t id)
+	{
+		auto entities = getEntities<Entity>();
+		auto res = entities->get(id);
+		if (res != nullptr)
+			destroyEntity<System>(*res);
+	}
+
+	// todo system parameter, this is used in callback
+	template <typename Entity>
+	void destroyEntity(uint64_t id)
+	{
+		destroyEntity<OmniSystem, Entity>(id);
+	}
+
+	template <typename System>
+	void destroyEntity(Guid guid)
+	{
+		dispatchGuid<EntityDestructorCallback<System>, Filter<Cont, EntityBase>>(guid);
+	}
+
+	void destroyEntity(Guid guid)
+	{
+		destroyEntity<OmniSystem>(guid);
+	}
+
+	template <typename Entity>
+	void destroyEntity(EntityId<Desc, Entity> key)
+	{
+		destroyEntity<Entity>(This::getEntityId(key));
+	}
+
+	// Clears the stores of the entity types in parallel, see EntityStore::clear.
+	template <typename ...Entities>
+	void destroyEntities()
+	{
+		using _set = tuple_utils::Set<Entities...>;
+		static constexpr size_t N = std::tuple_size<_set>::value;
+
+		void (*clears[N > 0 ? N : 1])(This*);
+		size_t count = 0;
+		tuple_utils::OncePerType<_set, DestroyEntitiesCallback>::fn(clears, count);
+		runTasks(count, [&](uint64_t i) { clears[i](this); });
+	}
+
+	// Memory use of the store of each entity type, see StoreStats. Call
+	// when no system is running.
+	std::vector<StoreStats> memoryStats() const
+	{
+		std::vector<StoreStats> stats;
+		tuple_utils::OncePerType<Filter<Cont, EntityBase>, MemoryStatsCallback>::fn(this, stats);
+		return stats;
+	}
+
+	// Table of memoryStats, one line per entity type and a total.
+	std::string memoryReport() const
+	{
+		char line[256];
+		std::string out;
+		StoreStats total;
+		auto kb = [] (uint64_t bytes) { return bytes / 1024.0; };
+
+		snprintf(line, sizeof(line), "%-24s %10s %10s %6s %12s %12s %12s %8s %8s\n",
+			"entity", "live", "slots", "tiers", "entity KB", "index KB", "maps KB", "frag", "runs");
+		out += line;
+
+		for (const StoreStats& s : memoryStats())
+		{
+			snprintf(line, sizeof(line), "%-24.24s %10llu %10llu %6llu %12.1f %12.1f %12.1f %7.1f%% %8llu\n",
+				s.name, static_cast<unsigned long long>(s.live), static_cast<unsigned long long>(s.slots),
+				static_cast<unsigned long long>(s.tiers), kb(s.entityBytes), kb(s.indexBytes + s.freeListBytes),
+				kb(s.mapBytes), 100.0 * s.fragmentation(), static_cast<unsigned long long>(s.runs));
+			out += line;
+
+			total.live += s.live;
+			total.entityBytes += s.entityBytes;
+			total.indexBytes += s.indexBytes + s.freeListBytes;
+			total.mapBytes += s.mapBytes;
+		}
+
+		snprintf(line, sizeof(line), "Total: %llu live, %.1f KB of which %.1f KB entities\n",
+			static_cast<unsigned long long>(total.live), kb(total.totalBytes()), kb(total.entityBytes));
+		out += line;
+		return out;
+	}
+
+	// Publishes the live copy of every Buffered component to its readers.
+	// Call between frames, when no system is running. runForSystems and
+	// runFrame call it at the end of each frame.
+	void commitBuffers()
+	{
+		tuple_utils::OncePerType<Filter<Cont, EntityBase>, CommitBuffersCallback>::fn(this);
+	}
+
+	static constexpr uint64_t typeKeyLength()
+	{
+		return ceil(log2(numUniques<Cont, EntityBase>()));
+	}
+
+	static uint64_t typeKey(Guid guid)
+	{
+		static const uint64_t klen = typeKeyLength();
+		uint64_t mask = ((uint64_t(1) << (klen + 1)) - 1) << (63 - klen);
+		return (guid.get() & mask) >> (63 - klen);
+	}
+	static uint64_t guidId(Guid guid)
+	{
+		static const uint64_t klen = typeKeyLength();
+		uint64_t key = typeKey(guid) << (63 - klen);
+
+		return guid.get() - key;
+	}
+
+	template <typename V>
+	static constexpr uint64_t absoluteIndex()
+	{
+		return tuple_utils::Index<V, Cont>::value;
+	}
+
+	static std::string dotGraphString()
+	{
+		std::string ret("digraph {\n");
+
+		tuple_utils::OncePerType<Cont, DotGenerateNodes>::fn(&ret);
+		using Filtered = tuple_utils::Union< Filter<Cont, EntityBase>, Filter<Cont, SystemBase>, Filter<Cont, ComponentBase>, Filter<Cont, IteratorBase>, Filter<Cont, ResourceBase>>;
+		oncePerPair<Filtered, DotGenerateEdges>(&ret);
+		ret += "}\n";
+
+		return ret;
+	}
+
+	struct DotGenerateNodes
+	{
+		template<typename V>
+		static void callback(std::string* str)
+		{
+			CZSS_CONST_IF (absoluteIndex<V>() == absoluteIndex<Dummy>())
+				return;
+
+			std::string a;
+			std::string shape = "box";
+
+			CZSS_CONST_IF(isSystem<V>())
+				shape = "ellipse";
+			CZSS_CONST_IF(isEntity<V>())
+				shape = "cylinder";
+			CZSS_CONST_IF(isComponent<V>())
+				shape = "rect";
+			CZSS_CONST_IF(isResource<V>())
+				shape = "diamond";
+
+			a += std::to_string(absoluteIndex<V>()) + " [label = " + czss::name<V>() + ", shape = " + shape + " ]\n";
+			str->append(a);
+		}
+	};
+
+	struct DotGenerateEdges
+	{
+		template<typename A, typename B>
+		static void callback(std::string* str)
+		{
+			CZSS_CONST_IF (absoluteIndex<A>() == absoluteIndex<Dummy>() || absoluteIndex<B>() == absoluteIndex<Dummy>())
+				return;
+
+			std::string an = std::to_string(absoluteIndex<A>());
+			std::string bn = std::to_string(absoluteIndex<B>());
+
+			std::string s;
+
+			CZSS_CONST_IF (isSystem<A>() && isSystem<B>() && !std::is_same<A, B>())
+			{
+				CZSS_CONST_IF (directlyDependsOn<A, B>())
+				{
+					CZSS_CONST_IF (!exclusiveWith<A, B>())
+						s += an + " -> " + bn + " [ style = dotted, color = grey ]\n";
+					else if (redundantDependency<A, B>())
+						s += an + " -> " + bn + " [ style = dotted, color = grey ]\n";
+					else
+						s += an + " -> " + bn + "\n";
+				}
+
+				CZSS_CONST_IF (exclusiveWith<A, B>() && !dependsOn<A, B>() && !dependsOn<B, A>())
+						s += an + " -> " + bn + " [ style = dotted ]\n";
+			}
+
+			CZSS_CONST_IF (isSystem<A>() && isComponent<B>())
+			{
+				CZSS_CONST_IF (canWrite<A, B>())
+					s += an + " -> " + bn + " [ color = yellow ]\n";
+
+				else CZSS_CONST_IF (canRead<A, B>())
+					s += an + " -> " + bn + " [ color = green ]\n";
+			}
+
+			CZSS_CONST_IF (isSystem<A>() && isEntity<B>())
+			{
+				CZSS_CONST_IF (canOrchestrate<A, B>())
+					s += an + " -> " + bn + " [ color = red ]\n";
+			}
+
+			CZSS_CONST_IF (isSystem<A>() && isResource<B>())
+			{
+				CZSS_CONST_IF (isThreadSafe<B>() && canWrite<A, B>())
+					s += an + " -> " + bn + " [ color = green ]\n";
+				else CZSS_CONST_IF (canWrite<A, B>())
+					s += an + " -> " + bn + " [ color = red ]\n";
+				else CZSS_CONST_IF (canRead<A, B>())
+					s += an + " -> " + bn + " [ color = green ]\n";
+			}
+
+			CZSS_CONST_IF((isEntity<A>() || isIterator<A>()) && isComponent<B>() && inspect::contains<Flatten<typename A::Cont>, B>())
+				s += an + " -> " + bn + "\n";
+
+			str->append(s);
+		}
+	};
+
+private:
+	RewrapElements<std::add_pointer, Filter<Cont, ResourceBase>> resources;
+	RewrapElements<EntityStore, Filter<Cont, EntityBase>> entities;
+
+	template <typename Entity, typename ...Params>
+	Entity* initializeEntity(Params&&... params)
+	{
+		static_assert(isEntity<Entity>(), "Template parameter must be an Entity.");
+
+		static_assert(typeKeyLength() + EntityStore<Entity>::ID_BITS <= 63, "Too many entity types for the Guid layout.");
+
+		Entity* ent;
+		uint64_t tk = entityIndex<Entity>() << 63 - typeKeyLength();
+		uint64_t id;
+		auto entities = getEntities<Entity>();
+		ent = entities->template create<Entity>(id, std::forward<Params>(params)...);
+
+		id += tk;
+		setEntityId(ent, id);
+
+		return ent;
+	}
+
+	struct CommitBuffersCallback
+	{
+		template <typename Value>
+		static void callback(This* arch)
+		{
+			using _buffered = tuple_utils::Subset<Flatten<typename Value::Cont>, BufferedFilter>;
+			CZSS_CONST_IF (std::tuple_size<_buffered>::value > 0)
+			{
+				for (Value* ent : arch->template getEntities<Value>()->used_indices)
+					ent->commitBuffered();
+			}
+		}
+	};
+
+	struct PublishConcurrentCallback
+	{
+		template <typename Value>
+		static void callback(This* arch)
+		{
+			arch->template getEntities<Value>()->publishConcurrent();
+		}
+	};
+
+	struct MemoryStatsCallback
+	{
+		template <typename Value>
+		static void callback(const This* arch, std::vector<StoreStats>& stats)
+		{
+			stats.push_back(const_cast<This*>(arch)->template getEntities<Value>()->stats());
+		}
+	};
+
+	struct DestroyEntitiesCallback
+	{
+		template <typename Value>
+		static void callback(void (**clears)(This*), size_t& count)
+		{
+			static_assert(isEntity<Value>(), "Only entities can be destroyed.");
+			clears[count++] = [](This* arch) {
+				arch->template getEntities<Value>()->clear();
+			};
+		}
+	};
+
+	template <typename System>
+	struct EntityDestructorCallback
+	{
+		template <typename Value>
+		inline static bool callback(This* arch, uint64_t id)
+		{
+			arch->template destroyEntity<System, Value>(id);
+			return true;
+		}
+	};
+
+	struct GetEntityVoidPtr
+	{
+		template <typename Value>
+		inline static bool callback(This* arch, uint64_t id, void*& ret)
+		{
+			ret = arch->template getEntity<Value>(id);
+			return ret != nullptr;
+		}
+	};
+
+	template <typename Cat>
+	struct NameFinder
+	{
+		template <typename Value>
+		inline static void callback(uint64_t id, const char** res)
+		{
+			if (std::is_base_of<Cat, Value>() && indexOf<Cont, Value, Cat>() == id)
+			{
+				*res = czss::name<Value>();
+			}
+		}
+	};
+
+	struct OnCreateCallback
+	{
+		template <typename Component, typename Entity, typename Accessor>
+		inline static void callback(Entity& value, Accessor& accessor)
+		{
+			onCreate(*value.template getComponent<Component>(), value, accessor);
+		}
+	};
+
+	struct OnCreateContextCallback
+	{
+		template <typename Component, typename Entity, typename Accessor, typename Context>
+		inline static void callback(Entity& value, Accessor& accessor, const Context& context)
+		{
+			onCreate(*value.template getComponent<Component>(), value, accessor, context);
+		}
+	};
+
+	struct OnDestroyCallback
+	{
+		template <typename Component, typename Entity, typename Accessor>
+		inline static void callback(Entity& value, Accessor& accessor)
+		{
+			onDestroy(*value.template getComponent<Component>(), value, accessor);
+		}
+	};
+};
+
+// #####################
+// Accessors
+// #####################
+
+template<typename Sys>
+struct HasEntityReadPermissionCallback
+{
+	template <typename Value>
+	static void callback()
+	{
+		static_assert(canRead<Sys, Value>(), "System cannot read component.");
+	}
+};
+
+template<typename Sys>
+struct HasEntityWritePermissionCallback
+{
+	template <typename Value>
+	static void callback()
+	{
+		static_assert(canWrite<Sys, Value>(), "System cannot write to component.");
+	}
+};
+
+// A viewed Entity hands out the live copy of its components, which systems
+// reading the committed copy of a Buffered one race with writers on.
+template<typename Sys>
+struct LiveEntityViewCallback
+{
+	template <typename Value>
+	static void callback()
+	{
+		static_assert(!CommittedReadCheck<Sys>::template callback<Value>(),
+			"System reads the committed copy of a Buffered component; view it through an accessor instead.");
+	}
+};
+
+template <typename Iter, typename Arch, typename Sys>
+struct IteratorAccessor;
+
+template <typename Iter, typename Arch, typename Sys>
+struct IterableStub;
+
+template <typename Iter, typename Arch, typename Sys>
+struct IteratorIterator;
+
+template<typename Arch, typename Sys>
+struct Accessor;
+
+template <typename Base, typename Derived>
+struct PermissionCompare
+{
+	template <typename V>
+	static constexpr void callback()
+	{
+		static_assert(isEntity<V>() && canOrchestrate<Derived, V>() ? canOrchestrate<Base, V>()
+				: ((isComponent<V>() || isResource<V>()) && canWrite<Derived, V>() ? canWrite<Base, V>()
+					: ((isComponent<V>() || isResource<V>()) && canRead<Derived, V>() ? canRead<Base, V>()
+						: true)),
+			"Derived accessor must have same or lesser permissions than the original.");
+	}
+};
+
+template <typename Base, typename Derived>
+static constexpr void canDeriveAssert()
+{
+	tuple_utils::OncePerType<typename Derived::Cont, PermissionCompare<Base, Derived>>::fn();
+}
+
+template<typename Sys, typename Entity>
+struct TypedEntityAccessor
+{
+	template <typename P>
+	operator TypedEntityAccessor<P, Entity>& ()
+	{
+		canDeriveAssert<Sys, P>();
+		return *reinterpret_cast<TypedEntityAccessor<P, Entity>*>(this);
+	}
+
+	TypedEntityAccessor(const Entity* ent)
+	{
+		_entity = const_cast<Entity*>(ent);
+	}
+
+	template<typename Component>
+	const Component* viewComponent() const
+	{
+		static_assert(canRead<Sys, Component>(), "System lacks read permissions for the Iterator's components.");
+		CZSS_CONST_IF (isBuffered<Component>() && !canWrite<Sys, Component>())
+			return _entity->template viewCommitted<Component>();
+		else
+			return _entity->template viewComponent<Component>();
+	}
+
+	template<typename Component>
+	Component* getComponent()
+	{
+		static_assert(canWrite<Sys, Component>(), "System lacks write permissions for the Iterator's components.");
+		return _entity->template getComponent<Component>();
+	}
+
+	Guid getGuid() const
+	{
+		return _entity->getGuid();
+	}
+
+	const Entity* viewEntity() const
+	{
+		tuple_utils::OncePerType<Flatten<typename Entity::Cont>, HasEntityReadPermissionCallback<Sys>>::fn();
+		tuple_utils::OncePerType<Flatten<typename Entity::Cont>, LiveEntityViewCallback<Sys>>::fn();
+		return _entity;
+	}
+
+	Entity* getEntity()
+	{
+		tuple_utils::OncePerType<Flatten<typename Entity::Cont>, HasEntityWritePermissionCallback<Sys>>::fn();
+		return _entity;
+	}
+
+private:
+	Entity* _entity;
+};
+
+// One component of consecutive entities. Entities hold their components
+// inline, so the elements are sizeof(Entity) bytes apart.
+template <typename T>
+struct StridedSpan
+{
+	struct iterator
+	{
+		T& operator*() const { return *reinterpret_cast<T*>(ptr); }
+		T* operator->() const { return reinterpret_cast<T*>(ptr); }
+		iterator& operator++() { ptr += stride; return *this; }
+		bool operator==(const iterator& other) const { return ptr == other.ptr; }
+		bool operator!=(const iterator& other) const { return ptr != other.ptr; }
+
+		char* ptr;
+		size_t stride;
+	};
+
+	StridedSpan(T* first, size_t count, size_t stride)
+		: first(reinterpret_cast<char*>(const_cast<typename std::remove_const<T>::type*>(first))), count(count), _stride(stride) { }
+
+	T& operator[](size_t i) const
+	{
+		return *reinterpret_cast<T*>(first + i * _stride);
+	}
+
+	T* data() const { return reinterpret_cast<T*>(first); }
+	size_t size() const { return count; }
+	// Distance between elements in bytes
+	size_t stride() const { return _stride; }
+
+	iterator begin() const { return { first, _stride }; }
+	iterator end() const { return { first + count * _stride, _stride }; }
+
+private:
+	char* first;
+	size_t count;
+	size_t _stride;
+};
+
+// Run of consecutive entities of one type, handed out by iterateChunks.
+template <typename Sys, typename Entity>
+struct TypedChunkAccessor
+{
+	TypedChunkAccessor(Entity* first, size_t count)
+		: _first(first), _count(count) { }
+
+	size_t size() const
+	{
+		return _count;
+	}
+
+	template<typename Component>
+	StridedSpan<const Component> viewComponent() const
+	{
+		static_assert(canRead<Sys, Component>(), "System lacks read permissions for the Iterator's components.");
+		CZSS_CONST_IF (isBuffered<Component>() && !canWrite<Sys, Component>())
+			return StridedSpan<const Component>(_first->template viewCommitted<Component>(), _count, sizeof(Entity));
+		else
+			return StridedSpan<const Component>(_first->template viewComponent<Component>(), _count, sizeof(Entity));
+	}
+
+	template<typename Component>
+	StridedSpan<Component> getComponent()
+	{
+		static_assert(canWrite<Sys, Component>(), "System lacks write permissions for the Iterator's components.");
+		return StridedSpan<Component>(_first->template getComponent<Component>(), _count, sizeof(Entity));
+	}
+
+	// Accessor of the i-th entity of the chunk
+	TypedEntityAccessor<Sys, Entity> operator[](size_t i) const
+	{
+		return TypedEntityAccessor<Sys, Entity>(_first + i);
+	}
+
+private:
+	Entity* _first;
+	size_t _count;
+};
+
+// Offset of a component from the start of its entity, of the committed
+// copy if Committed and the component is Buffered.
+template <typename Component, bool Committed, typename Entity>
+uint32_t componentOffset(const Entity* entity)
+{
+	const Component* component;
+	CZSS_CONST_IF (Committed)
+		component = entity->template viewCommitted<Component>();
+	else
+		component = entity->template viewComponent<Component>();
+
+	return static_cast<uint32_t>(reinterpret_cast<const char*>(component) - reinterpret_cast<const char*>(entity));
+}
+
+template <typename Arch, typename Sys>
+struct EntityAccessor
+{
+	template <typename P>
+	operator EntityAccessor<Arch, P>& ()
+	{
+		canDeriveAssert<Sys, P>();
+		return *reinterpret_cast<EntityAccessor<Arch, P>*>(this);
+	}
+
+	template <typename Entity>
+	EntityAccessor(const Entity* ent)
+	{
+		entity = const_cast<Entity*>(ent);
+		typeKey = indexOf<typename Arch::Cont, Entity, EntityBase>();
+	}
+
+	template <typename Component>
+	bool hasComponent() const
+	{
+		return viewComponent<Component>() != nullptr;
+	}
+
+	template<typename Component>
+	const Component* viewComponent() const
+	{
+		static_assert(canRead<Sys, Component>(), "System lacks read permissions for the Iterator's components.");
+		return get_ptr<Component, isBuffered<Component>() && !canWrite<Sys, Component>()>();
+	}
+
+	template<typename Component>
+	Component* getComponent()
+	{
+		static_assert(canWrite<Sys, Component>(), "System lacks write permissions for the Iterator's components.");
+		return get_ptr<Component>();
+	}
+
+	Guid getGuid() const
+	{
+		static constexpr auto& getters = GuidGetters::table;
+		if (entity == nullptr || typeKey >= getters.size())
+			return Guid();
+
+		return getters[typeKey](entity);
+	}
+
+	bool null() const
+	{
+		return entity == nullptr;
+	}
+
+protected:
+	EntityAccessor()
+	{
+		entity = nullptr;
+	}
+
+	EntityAccessor(const EntityAccessor<Arch, Sys>& other)
+	{
+		this->typeKey = other.typeKey;
+		this->entity = other.entity;
+	}
+
+	EntityAccessor(uint64_t typeKey, void* entity)
+	{
+		this->typeKey = typeKey;
+		this->entity = entity;
+	}
+
+protected:
+	uint64_t typeKey;
+	void* entity;
+
+private:
+	friend Accessor<Arch, Sys>;
+
+	using Entities = Filter<typename Arch::Cont, EntityBase>;
+	static constexpr size_t NUM_ENTITIES = std::tuple_size<Entities>::value;
+	static constexpr uint32_t ABSENT = std::numeric_limits<uint32_t>::max();
+
+	template <typename Component, bool Committed = false>
+	Component* get_ptr() const
+	{
+		const auto& offsets = OffsetTable<Component, Committed>::get();
+		if (entity == nullptr || typeKey >= NUM_ENTITIES || offsets[typeKey] == ABSENT)
+			return nullptr;
+
+		return reinterpret_cast<Component*>(reinterpret_cast<char*>(entity) + offsets[typeKey]);
+	}
+
+	// Offset of the component, or of its committed copy, in each entity
+	// type indexed by type key, ABSENT in types without it. Built once, on
+	// first use.
+	template <typename Component, bool Committed>
+	struct OffsetTable
+	{
+		template <typename Entity>
+		static uint32_t offset()
+		{
+			CZSS_CONST_IF (Entity::template hasComponent<Component>())
+				return componentOffset<Component, Committed>(reinterpret_cast<const Entity*>(OffsetProbe<Entity>::storage));
+			else
+				return ABSENT;
+		}
+
+		template <size_t ...I>
+		static std::array<uint32_t, NUM_ENTITIES> make(std::index_sequence<I...>)
+		{
+			return {{ offset<typename std::tuple_element<I, Entities>::type>()... }};
+		}
+
+		static const std::array<uint32_t, NUM_ENTITIES>& get()
+		{
+			static const std::array<uint32_t, NUM_ENTITIES> table = make(std::make_index_sequence<NUM_ENTITIES>());
+			return table;
+		}
+	};
+
+	// Offsets are taken as addresses within this storage, no entity is
+	// constructed in it and nothing is read from it.
+	template <typename Entity>
+	struct OffsetProbe
+	{
+		alignas(Entity) static inline unsigned char storage[sizeof(Entity)];
+	};
+
+	struct GuidGetters
+	{
+		using Fn = Guid (*)(const void*);
+
+		template <typename Entity>
+		static Guid get(const void* entity)
+		{
+			return reinterpret_cast<const Entity*>(entity)->getGuid();
+		}
+
+		template <size_t ...I>
+		static constexpr std::array<Fn, NUM_ENTITIES> make(std::index_sequence<I...>)
+		{
+			return {{ &get<typename std::tuple_element<I, Entities>::type>... }};
+		}
+
+		static constexpr std::array<Fn, NUM_ENTITIES> table = make(std::make_index_sequence<NUM_ENTITIES>());
+	};
+};
+
+// Components of the Iterator are found through offsets cached when the
+// iteration reaches a new entity type, other components dispatch on the
+// type like EntityAccessor.
+template <typename Iter, typename Arch, typename Sys>
+struct IteratorAccessor : EntityAccessor<Arch, Sys>
+{
+	IteratorAccessor(const IteratorAccessor<Iter, Arch, Sys>& other) : EntityAccessor<Arch, Sys>(other)
+	{
+		for (size_t i = 0; i < N; i++)
+			offsets[i] = other.offsets[i];
+	}
+
+	IteratorAccessor& operator=(const IteratorAccessor<Iter, Arch, Sys>& other) = default;
+
+	template <typename Component>
+	bool hasComponent() const
+	{
+		CZSS_CONST_IF (inspect::contains<Components, Component>())
+			return true;
+		else
+			return EntityAccessor<Arch, Sys>::template hasComponent<Component>();
+	}
+
+	template<typename Component>
+	const Component* viewComponent() const
+	{
+		CZSS_CONST_IF (inspect::contains<Components, Component>())
+		{
+			static_assert(canRead<Sys, Component>(), "System lacks read permissions for the Iterator's components.");
+			return reinterpret_cast<const Component*>(at<Component>());
+		}
+		else
+		{
+			return EntityAccessor<Arch, Sys>::template viewComponent<Component>();
+		}
+	}
+
+	template<typename Component>
+	Component* getComponent()
+	{
+		CZSS_CONST_IF (inspect::contains<Components, Component>())
+		{
+			static_assert(canWrite<Sys, Component>(), "System lacks write permissions for the Iterator's components.");
+			return reinterpret_cast<Component*>(at<Component>());
+		}
+		else
+		{
+			return EntityAccessor<Arch, Sys>::template getComponent<Component>();
+		}
+	}
+
+private:
+	friend IteratorIterator<Iter, Arch, Sys>;
+	friend Accessor<Arch, Sys>;
+
+	using Components = Filter<Flatten<typename Iter::Cont>, ComponentBase>;
+	static constexpr size_t N = std::tuple_size<Components>::value;
+
+	// Readers of a Buffered component see its committed copy, writers
+	// the live one, so one offset per component suffices.
+	uint32_t offsets[N > 0 ? N : 1];
+
+	IteratorAccessor() {}
+
+	template <typename Component>
+	char* at() const
+	{
+		static constexpr size_t I = min(tuple_utils::Index<Component, Components>::value, N - 1);
+		return reinterpret_cast<char*>(this->entity) + offsets[I];
+	}
+
+	template <typename Entity>
+	void setType(Entity* ent)
+	{
+		this->typeKey = indexOf<typename Arch::Cont, Entity, EntityBase>();
+		this->entity = ent;
+		tuple_utils::oncePerType2<tuple_utils::Numbered<Components>>([&] <typename P> () {
+			static constexpr size_t I = std::tuple_element<0, P>::type::value;
+			using Component = typename std::tuple_element<1, P>::type;
+			offsets[I] = componentOffset<Component, isBuffered<Component>() && !canWrite<Sys, Component>()>(ent);
+		});
+	}
+};
+
+template <typename Iter>
+struct IteratorCompatabilityFilter
+{
+	template <typename Entity>
+	static constexpr bool test()
+	{
+		return isEntity<Entity>() && isIteratorCompatibleWithEntity<Iter, Entity>();
+	}
+};
+
+// Walks the used_indices of one entity type at a time. Only moving on to
+// the next type dispatches on it; stepping within a type loads the next
+// pointer. Creating or destroying entities of the type being walked
+// invalidates the iterator.
+template <typename Iter, typename Arch, typename Sys>
+struct IteratorIterator
+{
+	using This = IteratorIterator<Iter, Arch, Sys>;
+	using U = IteratorAccessor<Iter, Arch, Sys>;
+
+	typedef uint64_t difference_type;
+	typedef U value_type;
+	typedef U& reference;
+	typedef U* pointer;
+	typedef std::forward_iterator_tag iterator_category;
+
+	IteratorIterator()
+	{
+		arch = nullptr;
+		typeKey = limit();
+	}
+
+	IteratorIterator(const IteratorIterator& other) = default;
+
+	U& operator* ()
+	{
+		return accessor;
+	}
+
+	U* operator-> ()
+	{
+		return &accessor;
+	}
+
+	friend bool operator== (const This& a, const This& b)
+	{
+		if (a.typeKey >= limit() && b.typeKey >= limit())
+			return true;
+
+		return a.typeKey == b.typeKey
+			&& a.current == b.current;
+	}
+
+	friend bool operator!= (const This& a, const This& b)
+	{
+		return !(a == b);
+	};
+
+	This operator++(int)
+	{
+		This ret = *this;
+		++(*this);
+		return ret;
+	}
+
+	This& operator++()
+	{
+		current += sizeof(void*);
+		if (current != last)
+			memcpy(&accessor.entity, current, sizeof(void*));
+		else
+			nextType();
+
+		return *this;
+	}
+
+private:
+	friend IterableStub<Iter, Arch, Sys>;
+	using CompatibleEntities = tuple_utils::Subset<typename Arch::Cont, IteratorCompatabilityFilter<Iter>>;
+
+	IteratorIterator(Arch* arch)
+	{
+		this->arch = arch;
+		typeKey = 0;
+		if (typeKey < limit())
+			tuple_utils::Switch<CompatibleEntities>::template fn<TypeSwitchCallback>(typeKey, this);
+		if (current == last)
+			nextType();
+	}
+
+	Arch* arch;
+	U accessor;
+	// Bytes of the current type's used_indices, as it's a vector of a
+	// different pointer type per entity type
+	const char* current = nullptr;
+	const char* last = nullptr;
+	uint64_t typeKey;
+
+	static constexpr size_t limit()
+	{
+		return std::tuple_size<CompatibleEntities>::value;
+	}
+
+	void nextType()
+	{
+		while (typeKey < limit())
+		{
+			typeKey++;
+			if (typeKey < limit())
+			{
+				tuple_utils::Switch<CompatibleEntities>::template fn<TypeSwitchCallback>(typeKey, this);
+				if (current != last)
+					return;
+			}
+		}
+	}
+
+	struct TypeSwitchCallback
+	{
+		template <typename Value>
+		static inline void callback(This* iterac)
+		{
+			auto& used = iterac->arch->template getEntities<Value>()->used_indices;
+			iterac->current = reinterpret_cast<const char*>(used.data());
+			iterac->last = reinterpret_cast<const char*>(used.data() + used.size());
+
+			if (!used.empty())
+				iterac->accessor.setType(used[0]);
+		}
+	};
+};
+
+template <typename Iter, typename Arch, typename Sys>
+struct IterableStub
+{
+	IteratorIterator<Iter, Arch, Sys> begin()
+	{
+		return IteratorIterator<Iter, Arch, Sys>(arch);
+	}
+
+	IteratorIterator<Iter, Arch, Sys> end()
+	{
+		return IteratorIterator<Iter, Arch, Sys>();
+	}
+
+private:
+	IterableStub(Arch* arch)
+	{
+		this ->arch = arch;
+	}
+	friend Accessor<Arch, Sys>;
+	Arch* arch;
+};
+
+template <typename Arch, typename Sys, typename ...Components>
+struct FilterAccessor
+{
+	template <typename F>
+	bool accessEntity(Guid guid, F f)
+	{
+		return arch->template accessEntityFiltered<Sys, F, Components...>(guid, f);
+	}
+
+private:
+	Arch* arch;
+	FilterAccessor(Arch* arch) : arch(arch) {}
+	friend Accessor<Arch, Sys>;
+};
+
+template <typename Arch, typename Sys, typename ...Components>
+struct ConstFilterAccessor
+{
+	template <typename F>
+	bool accessEntity(Guid guid, F f) const
+	{
+		return arch->template accessEntityFiltered<Sys, F, Components...>(guid, f);
+	}
+
+private:
+	Arch* arch;
+	ConstFilterAccessor(Arch* arch) : arch(arch) {}
+	friend Accessor<Arch, Sys>;
+};
+
+template<typename Arch, typename Sys>
+struct Accessor
+{
+	Accessor(const Accessor&) = delete;
+	Accessor(Accessor&&) = delete;
+	Accessor& operator=(const Accessor&) = delete;
+	Accessor& operator=(Accessor&&) = delete;
+
+public:
+	template <typename P>
+	operator Accessor<Arch, P>& ()
+	{
+		canDeriveAssert<Sys, P>();
+		return *reinterpret_cast<Accessor<Arch, P>*>(this);
+	}
+
+	template <typename Entity, typename ...Params>
+	Entity* createEntity(Params&&... params)
+	{
+		entityPermission<Entity>();
+		return arch->template createEntity<Entity>(std::forward<Params>(params)...);
+	}
+
+	template <typename Entity, typename Context, typename ...Params>
+	Entity* createEntityWithContext(Context&& context, Params&&... params)
+	{
+		entityPermission<Entity>();
+		return arch->template createEntityWithContext<Entity>(context, std::forward(params)...);
+	}
+
+	// Safe to call from parallel tasks of the system. The entity becomes
+	// visible when the parallelIterate or minirun it was created in returns,
+	// or on publishConcurrentEntities.
+	template <typename Entity, typename ...Params>
+	Entity* createEntityConcurrent(Params&&... params)
+	{
+		entityPermission<Entity>();
+		return arch->template createEntityConcurrent<Entity, Sys>(std::forward<Params>(params)...);
+	}
+
+	// Publishes entities created concurrently, of the types the system
+	// orchestrates. Call when no task of the system is creating any.
+	void publishConcurrentEntities()
+	{
+		using _orchestrated = tuple_utils::Subset<typename Arch::Cont, OrchestratedFilter>;
+		tuple_utils::OncePerType<_orchestrated, PublishConcurrentCallback>::fn(arch);
+	}
+
+	template <typename Entity>
+	EntityAccessor<Arch, Sys> entityAccessor(const Entity* entity)
+	{
+		return EntityAccessor<Arch, Sys>(entity);
+	}
+
+	EntityAccessor<Arch, Sys> entityAccessor(Guid guid)
+	{
+		void* ptr = arch->getEntity(guid);
+		uint64_t typeKey = Arch::typeKey(guid);
+		return EntityAccessor<Arch, Sys>(typeKey, ptr);
+	}
+
+	template <typename F>
+	bool accessEntity(Guid guid, F f)
+	{
+		return arch->template accessEntity<Sys>(guid, f);
+	}
+
+	// Calls f(accessor) for each live entity of guids, in memory order
+	// rather than the order of guids. Returns how many were found.
+	template <typename F>
+	size_t accessEntities(std::span<const Guid> guids, F f)
+	{
+		return arch->template accessEntities<Sys>(guids, f);
+	}
+
+	// Calls f(taskIndex, accessor) for each live entity of guids from
+	// numTasks tasks, guids shouldn't hold duplicates.
+	template <typename F>
+	size_t parallelAccessEntities(uint64_t numTasks, std::span<const Guid> guids, F f)
+	{
+		size_t resolved = arch->template parallelAccessEntities<Sys>(numTasks, guids, f);
+		publishConcurrentEntities();
+		return resolved;
+	}
+
+	// Uses a task per ACCESS_GRAIN Guids.
+	template <typename F>
+	size_t parallelAccessEntities(std::span<const Guid> guids, F f)
+	{
+		return parallelAccessEntities(max(uint64_t(1), uint64_t(guids.size() / ACCESS_GRAIN)), guids, f);
+	}
+
+	static constexpr uint64_t ACCESS_GRAIN = 16384;
+
+	template <typename Component, typename F>
+	bool accessComponent(Guid guid, F f)
+	{
+		return arch->template accessComponent<Sys, Component>(guid, f);
+	}
+
+	template <typename ...Components>
+	FilterAccessor<Arch, Sys, Components...> filterEntities()
+	{
+		return FilterAccessor<Arch, Sys, Components...>(arch);
+	}
+
+	template <typename ...Components>
+	ConstFilterAccessor<Arch, Sys, Components...> filterEntitiesConst() const
+	{
+		return ConstFilterAccessor<Arch, Sys, Components...>(arch);
+	}
+
+	template <typename Entity>
+	const Entity* viewEntity(Guid guid) const
+	{
+		static_assert(isEntity<Entity>(), "Attempted to create non-entity.");
+		tuple_utils::OncePerType<Flatten<typename Entity::Cont>, HasEntityReadPermissionCallback<Sys>>::fn();
+		tuple_utils::OncePerType<Flatten<typename Entity::Cont>, LiveEntityViewCallback<Sys>>::fn();
+		static_assert(inspect::contains<typename Arch::Cont, Entity>(), "Architecture doesn't contain the Entity.");
+		return arch->template getEntity<Entity>(guid);
+	}
+
+	template <typename Entity>
+	const Entity* viewEntity(EntityId<Arch, Entity> id) const
+	{
+		static_assert(isEntity<Entity>(), "Attempted to create non-entity.");
+		tuple_utils::OncePerType<Flatten<typename Entity::Cont>, HasEntityReadPermissionCallback<Sys>>::fn();
+		tuple_utils::OncePerType<Flatten<typename Entity::Cont>, LiveEntityViewCallback<Sys>>::fn();
+		static_assert(inspect::contains<typename Arch::Cont, Entity>(), "Architecture doesn't contain the Entity.");
+		return arch->template getEntity<Entity>(id);
+	}
+
+	template <typename Entity>
+	Entity* getEntity(Guid guid)
+	{
+		static_assert(isEntity<Entity>(), "Attempted to create non-entity.");
+		tuple_utils::OncePerType<Flatten<typename Entity::Cont>, HasEntityWritePermissionCallback<Sys>>::fn();
+		static_assert(inspect::contains<typename Arch::Cont, Entity>(), "Architecture doesn't contain the Entity.");
+		return arch->template getEntity<Entity>(guid);
+	}
+
+	template <typename Entity>
+	Entity* getEntity(EntityId<Arch, Entity> id)
+	{
+		static_assert(isEntity<Entity>(), "Attempted to create non-entity.");
+		tuple_utils::OncePerType<Flatten<typename Entity::Cont>, HasEntityWritePermissionCallback<Sys>>::fn();
+		static_assert(inspect::contains<typename Arch::Cont, Entity>(), "Architecture doesn't contain the Entity.");
+		return arch->template getEntity<Entity>(id);
+	}
+
+	template <typename Entity>
+	EntityId<Arch, Entity> getEntityId(const Entity* ent) const
+	{
+		return Arch::getEntityId(ent);
+	}
+
+	void destroyEntity(Guid guid)
+	{
+		if (tuple_utils::OncePerType<typename Arch::Cont, EntityDestructionPermission>::constFn(Arch::typeKey(guid)))
+		{
+			arch->template destroyEntity<Sys>(guid);
+		}
+	}
+
+	template <typename Entity>
+	void destroyEntity(EntityId<Arch, Entity> key)
+	{
+		static_assert(Sys::template canOrchestrate<Entity>(), "System does not have the permission to destroy this entity.");
+		arch->template destroyEntity<Sys>(key);
+	}
+
+	template <typename ...Entities>
+	void destroyEntities()
+	{
+		tuple_utils::OncePerType<Rbox<Entities...>, EntityOrchestrationPermissionTest>::fn();
+		arch->template destroyEntities<Entities...>();
+	}
+
+	void commitBuffers()
+	{
+		using _components = Filter<Flatten<Filter<typename Arch::Cont, EntityBase>>, ComponentBase>;
+		using _buffered = tuple_utils::Subset<_components, BufferedFilter>;
+		tuple_utils::OncePerType<_buffered, HasEntityWritePermissionCallback<Sys>>::fn();
+		arch->commitBuffers();
+	}
+
+	struct MiniRunMapper
+	{
+		template <typename V>
+		struct MrmImpl
+		{
+			using type = V;
+			using fn = V;
+		};
+
+		template <typename A, typename S>
+		struct MrmImpl<void(*)(Accessor<A, S>)>
+		{
+			using type = S;
+			using fn = void(*)(Accessor<A, S>);
+		};
+
+		template <typename A, typename S>
+		struct MrmImpl<void(*)(Accessor<A, S>&)>
+		{
+			using type = S;
+			using fn = void(*)(Accessor<A, S>&);
+		};
+
+		template <typename A, typename S>
+		struct MrmImpl<void(*)(const Accessor<A, S>&)>
+		{
+			using type = S;
+			using fn = void(*)(const Accessor<A, S>&);
+		};
+
+#ifdef CZSS_COROUTINES
+		template <typename A, typename S>
+		struct MrmImpl<SystemTask(*)(Accessor<A, S>&)>
+		{
+			using type = S;
+			using fn = SystemTask(*)(Accessor<A, S>&);
+		};
+#endif
+
+		template <typename V>
+		using type = typename MrmImpl<V>::type;
+
+		template <typename V>
+		using fn = typename MrmImpl<V>::fn;
+	};
+
+	// waits[I][J] is set when system I must wait for the earlier system J.
+	// Waits already implied through another wait of I are dropped.
+	template <typename Systems>
+	struct MiniRunGraph
+	{
+		static constexpr size_t N = std::tuple_size<Systems>::value;
+		using Table = std::array<std::array<bool, N>, N>;
+
+		template <size_t I, size_t ...J>
+		static constexpr std::array<bool, N> exclusiveWithEarlier(std::index_sequence<J...>)
+		{
+			return {{ (J < I && exclusiveWith<
+				typename std::tuple_element<I, Systems>::type,
+				typename std::tuple_element<J, Systems>::type>())... }};
+		}
+
+		template <size_t ...I>
+		static constexpr Table edges(std::index_sequence<I...> seq)
+		{
+			return {{ exclusiveWithEarlier<I>(seq)... }};
+		}
+
+		static constexpr Table reduce(const Table& edge)
+		{
+			Table reach = edge;
+			for (size_t k = 0; k < N; k++)
+				for (size_t i = 0; i < N; i++)
+					for (size_t j = 0; j < N; j++)
+						reach[i][j] = reach[i][j] || (reach[i][k] && reach[k][j]);
+
+			Table ret = edge;
+			for (size_t i = 0; i < N; i++)
+				for (size_t j = 0; j < N; j++)
+					for (size_t k = 0; k < N; k++)
+						if (edge[i][k] && reach[k][j])
+							ret[i][j] = false;
+
+			return ret;
+		}
+
+		static constexpr Table waits = reduce(edges(std::make_index_sequence<N>()));
+	};
+
+	struct MinirunTaskData
+	{
+		Backend::Barrier* barriers;
+		void (*fn) (void*);
+		Accessor<Arch, Sys>* arch;
+		size_t i;
+	};
+
+	template <size_t I, typename Systems, typename P>
+	static void _minirun(MinirunTaskData* task)
+	{
+		tuple_utils::oncePerType2<tuple_utils::Numbered<Systems>>([&] <typename O> () {
+			static constexpr size_t J = std::tuple_element<0, O>::type::value;
+			CZSS_CONST_IF (MiniRunGraph<Systems>::waits[I][J])
+				task->barriers[J].wait();
+		});
+
+		using Entry = typename std::tuple_element<I, Systems>::type;
+#ifdef CZSS_BACKEND_THREAD_POOL
+		CZSS_PROFILE_SCOPE(czss::name<Entry>(), "minirun", I);
+#else
+		CZSS_PROFILE_ASYNC_SCOPE(czss::name<Entry>(), "minirun", Profiler::asyncId());
+#endif
+		auto fn = reinterpret_cast<typename MiniRunMapper::template fn<P>>(task->fn);
+		invokeSystem(fn, *task->arch);
+	}
+
+	template <typename ...S>
+	void minirun(S... fn)
+	{
+		using _systems = tuple_utils::Map<std::tuple<S...>, MiniRunMapper>;
+		using _numbered = tuple_utils::Numbered<_systems>;
+
+		static constexpr size_t N = sizeof...(S);
+		static_assert(N > 0, "minirun requires at least one system.");
+		auto pointers = std::tuple(fn...);
+
+		Backend::Activity activity;
+		Backend::Barrier barriers[N];
+		MinirunTaskData taskData[N];
+
+		for (size_t i = 0; i < N; i++)
+			barriers[i].setValue(1);
+
+		tuple_utils::oncePerType2<_numbered>([&] <typename P> () {
+			static constexpr size_t I = std::tuple_element<0, P>::type::value;
+
+			taskData[I].barriers = barriers;
+			taskData[I].fn = reinterpret_cast<void(*)(void*)> (std::get<I>(pointers));
+			taskData[I].arch = this;
+			taskData[I].i = I;
+			Backend::run(_minirun<I, _systems, typename std::tuple_element<I, decltype(pointers)>::type>, &taskData[I], 1, &barriers[I]);
+		});
+
+		for (size_t i = 0; i < N; i++)
+			barriers[i].wait();
+
+		publishConcurrentEntities();
+	}
+
+
+	template <typename Resource>
+	const Resource* viewResource() const
+	{
+		static_assert(isResource<Resource>(), "Attempted to read non-resource.");
+		static_assert(canRead<Sys, Resource>(), "System lacks permission to read Resource.");
+		static_assert(inspect::contains<typename Arch::Cont, Resource>(), "Architecture doesn't contain the Resource.");
+		return arch->template getResource<Resource>();
+	}
+
+	template <typename Resource>
+	Resource* getResource()
+	{
+		static_assert(isResource<Resource>(), "Attempted to write to non-resource.");
+		static_assert(canWrite<Sys, Resource>(), "System lacks permission to modify Resource.");
+		static_assert(inspect::contains<typename Arch::Cont, Resource>(), "Architecture doesn't contain the Resource.");
+		return arch->template getResource<Resource>();
+	}
+
+	// TODO add special permission?
+	template <typename Resource>
+	void setResource(Resource* res)
+	{
+		static_assert(isResource<Resource>(), "Attempted to write to non-resource.");
+		static_assert(canWrite<Sys, Resource>(), "System lacks permission to modify Resource.");
+		static_assert(inspect::contains<typename Arch::Cont, Resource>(), "Architecture doesn't contain the Resource.");
+		arch->setResource(res);
+	}
+
+	template <typename Iterator>
+	IterableStub<Iterator, Arch, Sys> iterate()
+	{
+		iteratorPermission<Iterator>();
+		return IterableStub<Iterator, Arch, Sys>(arch);
+	}
+
+	template <typename ...Values>
+	IterableStub<Iterator<Values...>, Arch, Sys> iterate2()
+	{
+		return iterate<Iterator<Values...>>();
+	}
+
+	template <typename Iterator, typename F>
+	void iterate(F f)
+	{
+		using _compat = tuple_utils::Subset<typename Arch::Cont, IteratorCompatabilityFilter<Iterator>>;
+		iteratorPermission<Iterator>();
+
+		tuple_utils::OncePerType<_compat, TypedIteratorCallback<Iterator>>::fn(f, arch);
+	}
+
+	// Calls f with a TypedChunkAccessor per run of up to maxChunk entities
+	// that lie next to each other in memory, e.g. for loops the compiler
+	// can vectorize. Entities of virtual types come one per chunk.
+	template <typename Iterator, typename F>
+	void iterateChunks(size_t maxChunk, F f)
+	{
+		using _compat = tuple_utils::Subset<typename Arch::Cont, IteratorCompatabilityFilter<Iterator>>;
+		iteratorPermission<Iterator>();
+
+		tuple_utils::OncePerType<_compat, TypedChunkCallback<Iterator>>::fn(f, arch, max(maxChunk, size_t(1)));
+	}
+
+	template <typename Iterator, typename F>
+	void iterateChunks(F f)
+	{
+		iterateChunks<Iterator>(CHUNK_SIZE, f);
+	}
+
+	static constexpr size_t CHUNK_SIZE = 1024;
+
+	// Copies the Fields, pointers to data members of components, of up to
+	// BATCH_SIZE entities at a time into 64 byte aligned buffers and calls
+	// kernel(count, buffers...). Buffers are T* and copied back afterwards
+	// for fields the system can write and kernel can't take as const T*,
+	// the others are const T*. An auto* parameter takes const T*, so
+	// kernels spell out T* for the buffers they write.
+	template <typename Iterator, auto ...Fields, typename Kernel>
+	void batch(Kernel kernel)
+	{
+		std::tuple<BatchBuffer<typename FieldTraits<decltype(Fields)>::Type>...> buffers;
+
+		iterateChunks<Iterator>(BATCH_SIZE, [&] (auto& chunk) {
+			size_t count = chunk.size();
+			[&] <size_t ...I> (std::index_sequence<I...>) {
+				constexpr std::array<bool, sizeof...(Fields)> writes = {
+					kernelWrites<I, Kernel, FieldPointer<Fields>...>(std::index_sequence_for<decltype(Fields)...>())...
+				};
+				(gatherField<Fields>(chunk, std::get<I>(buffers).data), ...);
+				kernel(count, fieldBuffer<writes[I]>(std::get<I>(buffers).data)...);
+				(scatterField<Fields, writes[I]>(chunk, std::get<I>(buffers).data), ...);
+			}(std::index_sequence_for<decltype(Fields)...>());
+		});
+	}
+
+	// Y += a * X for every entity
+	template <typename Iterator, auto Y, auto X>
+	void batchAxpy(typename FieldTraits<decltype(Y)>::Type a)
+	{
+		using T = typename FieldTraits<decltype(Y)>::Type;
+		static_assert(canWrite<Sys, typename FieldTraits<decltype(Y)>::Component>(), "System lacks write permissions for the field's component.");
+		static_assert(!std::is_same<FieldTag<Y>, FieldTag<X>>::value, "Y and X must be different fields.");
+		batch<Iterator, Y, X>([a] (size_t count, T* y, const T* x) { simd::axpy(y, x, a, count); });
+	}
+
+	// Clamps X to [lo, hi] for every entity
+	template <typename Iterator, auto X>
+	void batchClamp(typename FieldTraits<decltype(X)>::Type lo, typename FieldTraits<decltype(X)>::Type hi)
+	{
+		using T = typename FieldTraits<decltype(X)>::Type;
+		static_assert(canWrite<Sys, typename FieldTraits<decltype(X)>::Component>(), "System lacks write permissions for the field's component.");
+		batch<Iterator, X>([lo, hi] (size_t count, T* x) { simd::clamp(x, lo, hi, count); });
+	}
+
+	template <typename Iterator, auto X>
+	typename FieldTraits<decltype(X)>::Type batchMin()
+	{
+		using T = typename FieldTraits<decltype(X)>::Type;
+		T result = simd::Min::identity<T>();
+		batch<Iterator, X>([&] (size_t count, const T* x) { simd::Min::apply(result, simd::min(x, count)); });
+		return result;
+	}
+
+	template <typename Iterator, auto X>
+	typename FieldTraits<decltype(X)>::Type batchMax()
+	{
+		using T = typename FieldTraits<decltype(X)>::Type;
+		T result = simd::Max::identity<T>();
+		batch<Iterator, X>([&] (size_t count, const T* x) { simd::Max::apply(result, simd::max(x, count)); });
+		return result;
+	}
+
+	template <typename Iterator, auto X>
+	typename FieldTraits<decltype(X)>::Type batchSum()
+	{
+		using T = typename FieldTraits<decltype(X)>::Type;
+		T result = T(0);
+		batch<Iterator, X>([&] (size_t count, const T* x) { result += simd::sum(x, count); });
+		return result;
+	}
+
+	static constexpr size_t BATCH_SIZE = 1024;
+
+	// Calls f(source, target) with TypedEntityAccessors for each entity of
+	// Iterator whose Relation, a Guid member of one of the Iterator's
+	// components, refers to a live entity compatible with TargetIterator.
+	// Per source type the targets are looked up by Guid, grouped by type and
+	// visited in memory order, so calls don't follow the order of the sources.
+	template <typename Iterator, auto Relation, typename TargetIterator, typename F>
+	void join(F f)
+	{
+		using Relations = typename FieldTraits<decltype(Relation)>::Component;
+		using _compat = tuple_utils::Subset<typename Arch::Cont, IteratorCompatabilityFilter<Iterator>>;
+		static_assert(std::is_same<typename FieldTraits<decltype(Relation)>::Type, Guid>::value, "Relation must be a Guid member of a component.");
+		static_assert(inspect::contains<Filter<Flatten<typename Iterator::Cont>, ComponentBase>, Relations>(), "Relation must belong to a component of the Iterator.");
+		iteratorPermission<Iterator>();
+		iteratorPermission<TargetIterator>();
+
+		tuple_utils::OncePerType<_compat, JoinSourceCallback<Relation, TargetIterator>>::fn(f, arch);
+	}
+
+	// Targets this many pairs ahead are prefetched during join
+	static constexpr size_t JOIN_PREFETCH = 8;
+
+	template <typename Iterator, typename F>
+	void parallelIterate(uint64_t numTasks, F f)
+	{
+		parallelIterateImpl<Iterator>(numTasks, f, TypedParallelIterateTask<Iterator, F>);
+	}
+
+	// Maps each entity of the iterator to a T and folds the values with
+	// combine, which must be associative. Tasks fold into partials on their
+	// own cache lines, which are then combined pairwise in task order, so
+	// the result depends only on numTasks and the order of the entities.
+	template <typename Iterator, typename T, typename Map, typename Combine>
+	T parallelReduce(uint64_t numTasks, T identity, Map map, Combine combine)
+	{
+		struct alignas(64) Partial
+		{
+			T value;
+		};
+
+		numTasks = max(numTasks, uint64_t(1));
+		ScratchArray<Partial> partials(numTasks, Partial { identity });
+
+		parallelIterate<Iterator>(numTasks, [&] (uint64_t index, auto& accessor) {
+			T& partial = partials[index].value;
+			partial = combine(partial, map(accessor));
+		});
+
+		for (uint64_t stride = 1; stride < numTasks; stride *= 2)
+		{
+			for (uint64_t i = 0; i + stride < numTasks; i += 2 * stride)
+				partials[i].value = combine(partials[i].value, partials[i + stride].value);
+		}
+
+		return partials[0].value;
+	}
+
+	// Uses a task per REDUCE_GRAIN entities.
+	template <typename Iterator, typename T, typename Map, typename Combine>
+	T parallelReduce(T identity, Map map, Combine combine)
+	{
+		uint64_t numTasks = countCompatibleEntities<Iterator>() / REDUCE_GRAIN;
+		return parallelReduce<Iterator>(max(numTasks, uint64_t(1)), identity, map, combine);
+	}
+
+	static constexpr uint64_t REDUCE_GRAIN = 8192;
+
+	template <typename Iterator>
+	uint64_t countCompatibleEntities()
+	{
+		uint64_t entityCount = 0;
+		using _compat = tuple_utils::Subset<typename Arch::Cont, IteratorCompatabilityFilter<Iterator>>;
+		tuple_utils::OncePerType<_compat, EntityCountCallback>::fn(&entityCount, arch);
+		return entityCount;
+	}
+
+// private:
+	// friend Arch;
+	Accessor(Arch* arch) { this->arch = arch; }
+	Arch* arch;
+
+private:
+	template <typename Iterator, typename F, typename CB>
+	void parallelIterateImpl(uint64_t numTasks, F f, CB* cb)
+	{
+		iteratorPermission<Iterator>();
+		using _compat = tuple_utils::Subset<typename Arch::Cont, IteratorCompatabilityFilter<Iterator>>;
+		CZSS_CONST_IF (std::tuple_size<tuple_utils::Subset<_compat, VirtualFilter>>::value == 0)
+		{
+			if (Backend::numaNodes() > 1)
+			{
+				parallelIterateOnNodes<Iterator>(numTasks, f);
+				return;
+			}
+		}
+
+		uint64_t counter = countCompatibleEntities<Iterator>();
+		Backend::Activity activity;
+
+		ScratchArray<ParallelIterateTaskData<F>> taskvec(numTasks);
+		ParallelIterateTaskData<F>* tasks = taskvec.data();
+
+		for (uint64_t i = 0; i < numTasks; i++)
+		{
+			tasks[i].index = i;
+			tasks[i].arch = arch;
+			tasks[i].func = &f;
+			tasks[i].entityCount = min(counter, max(uint64_t(1), counter / (numTasks - i)));
+			counter -= tasks[i].entityCount;
+
+			if (i > 0)
+			{
+				tasks[i].beginIndex = tasks[i - 1].beginIndex + tasks[i - 1].entityCount;
+			}
+
+			if (counter == 0)
+			{
+				numTasks = i + 1;
+				break;
+			}
+		}
+
+		Backend::Barrier barrier(numTasks);
+		Backend::run(cb, tasks, numTasks, &barrier);
+		barrier.wait();
+		publishConcurrentEntities();
+	}
+
+	// Splits the live entities in slot order instead of used_indices order,
+	// so each task covers a run of tier memory and runs on the node it was
+	// placed on.
+	template <typename Iterator, typename F>
+	void parallelIterateOnNodes(uint64_t numTasks, F& f)
+	{
+		using _compat = tuple_utils::Subset<typename Arch::Cont, IteratorCompatabilityFilter<Iterator>>;
+		uint64_t counter = countCompatibleEntities<Iterator>();
+		if (counter == 0)
+			return;
+
+		Backend::Activity activity;
+
+		numTasks = min(numTasks, counter);
+		ScratchArray<NodeIterateTaskData<F>> tasks(numTasks);
+		ScratchArray<uint32_t> nodes(numTasks);
+
+		uint64_t begin = 0;
+		for (uint64_t i = 0; i < numTasks; i++)
+		{
+			tasks[i].index = i;
+			tasks[i].arch = arch;
+			tasks[i].func = &f;
+			tasks[i].beginRank = begin;
+			tasks[i].entityCount = max(uint64_t(1), counter / (numTasks - i));
+			counter -= tasks[i].entityCount;
+			begin += tasks[i].entityCount;
+		}
+
+		NodePartition<F> partition { tasks.data(), nodes.data(), numTasks };
+		tuple_utils::OncePerType<_compat, NodePartitionCallback>::fn(&partition, arch);
+
+		Backend::Barrier barrier(numTasks);
+		Backend::runOnNodes(NodeIterateTask<Iterator, F>, tasks.data(), numTasks, &barrier, nodes.data());
+		barrier.wait();
+		publishConcurrentEntities();
+	}
+
+	template <typename Iterator>
+	static void iteratorPermission()
+	{
+		static_assert(isIterator<Iterator>(), "Attempted to iterate non-iterator.");
+		static_assert(inspect::containsAllIn<SystemAccesses<Sys>, typename Iterator::Cont>(), "System doesn't have access to all components of Iterator.");
+	}
+
+	template <typename Entity>
+	static void entityPermission()
+	{
+		static_assert(isEntity<Entity>(), "Attempted to orchestrate non-entity.");
+		static_assert(canOrchestrate<Sys, Entity>(), "System lacks permission to orchestrate the Entity.");
+		// static_assert(inspect::contains<typename Arch::Cont, Entity>(), "Architecture doesn't contain the Entity.");
+	}
+
+	struct EntityDestructionPermission
+	{
+		template <typename Value>
+		static constexpr bool callback(const uint64_t& key)
+		{
+			return isEntity<Value>()
+				&& indexOf<typename Arch::Cont, Value, EntityBase>() == key
+				&& canOrchestrate<Sys, Value>();
+		}
+	};
+
+	struct EntityOrchestrationPermissionTest
+	{
+		template <typename V>
+		static void callback()
+		{
+			entityPermission<V>();
+		}
+	};
+
+	template <typename Other, typename Systems>
+	struct SystemAccessValidationCallback
+	{
+		template <typename Value>
+		static void callback()
+		{
+			#define ErrorMessage "System running other systems via accessor must have all permissions of the systems being run."
+
+			CZSS_CONST_IF (isComponent<Value>())
+			{
+				CZSS_CONST_IF (canRead<Other, Value>())
+					static_assert(canRead<Sys, Value>(), ErrorMessage);
+
+				CZSS_CONST_IF (canWrite<Other, Value>())
+					static_assert(canWrite<Sys, Value>(), ErrorMessage);
+			}
+
+			CZSS_CONST_IF (isEntity<Value>())
+			{
+				CZSS_CONST_IF (canOrchestrate<Other, Value>())
+					static_assert(canOrchestrate<Sys, Value>(), ErrorMessage);
+			}
+
+			#undef ErrorMessage
+
+			CZSS_CONST_IF (isSystem<Value>())
+			{
+				static_assert(!inspect::contains<Arch::Cont, Value>(), "Subsystems must not refer any types in the architecture");
+				static_assert(inspect::contains<Systems, Value>(), "Subsystem run must include all dependencies.");
+			}
+		}
+	};
+
+	template <typename Systems>
+	struct SystemsRunPermissionTest
+	{
+		template <typename V>
+		static void callback()
+		{
+			static_assert(isSystem<V>(), "Only systems allowed as template parameters.");
+			static_assert(!inspect::contains<Arch::Cont, V>(), "Architecture must not refer to system.");
+			typename V::Cont::template evaluate<tuple_utils::OncePerType<Dummy, SystemAccessValidationCallback<V, Systems>>>();
+		}
+	};
+
+	template <typename Iterator>
+	struct TypedIteratorCallback
+	{
+		template <typename Value, typename F>
+		static inline void callback(F& f, Arch* arch)
+		{
+			CZSS_CONST_IF (isEntity<Value>() && isIteratorCompatibleWithEntity<Iterator, Value>())
+			{
+				auto ents = arch->template getEntities<Value>();
+				for (auto& ent : ents->used_indices)
+				{
+					auto accessor = TypedEntityAccessor<Sys, Value>(ent);
+					f(accessor);
+				}
+			}
+		}
+	};
+
+	struct OrchestratedFilter
+	{
+		template <typename Value>
+		static constexpr bool test()
+		{
+			return isEntity<Value>() && canOrchestrate<Sys, Value>();
+		}
+	};
+
+	struct PublishConcurrentCallback
+	{
+		template <typename Entity>
+		static inline void callback(Arch* arch)
+		{
+			arch->template getEntities<Entity>()->publishConcurrent();
+		}
+	};
+
+	template <auto Field>
+	struct FieldTag {};
+
+	template <typename T>
+	struct alignas(64) BatchBuffer
+	{
+		T data[BATCH_SIZE];
+	};
+
+	template <auto Field>
+	static constexpr bool canWriteField()
+	{
+		return canWrite<Sys, typename FieldTraits<decltype(Field)>::Component>();
+	}
+
+	// The most a kernel gets of Field: T* if the system can write it
+	template <auto Field>
+	using FieldPointer = std::conditional_t<canWriteField<Field>(),
+		typename FieldTraits<decltype(Field)>::Type*, const typename FieldTraits<decltype(Field)>::Type*>;
+
+	// Whether the Ith of Pointers is mutable and kernel can't take it as
+	// const, so writes to it must be copied back.
+	template <size_t I, typename Kernel, typename ...Pointers, size_t ...J>
+	static constexpr bool kernelWrites(std::index_sequence<J...>)
+	{
+		using P = std::tuple_element_t<I, std::tuple<Pointers...>>;
+		return !std::is_const<std::remove_pointer_t<P>>::value
+			&& !std::is_invocable<Kernel&, size_t,
+				std::conditional_t<I == J, const std::remove_pointer_t<Pointers>*, Pointers>...>::value;
+	}
+
+	template <bool Write, typename T>
+	static auto fieldBuffer(T* data)
+	{
+		CZSS_CONST_IF (Write)
+			return data;
+		else
+			return const_cast<const T*>(data);
+	}
+
+	template <auto Field, typename Chunk, typename T>
+	static void gatherField(Chunk& chunk, T* data)
+	{
+		auto span = chunk.template viewComponent<typename FieldTraits<decltype(Field)>::Component>();
+		for (size_t i = 0; i < span.size(); i++)
+			data[i] = span[i].*Field;
+	}
+
+	template <auto Field, bool Write, typename Chunk, typename T>
+	static void scatterField(Chunk& chunk, const T* data)
+	{
+		CZSS_CONST_IF (Write)
+		{
+			auto span = chunk.template getComponent<typename FieldTraits<decltype(Field)>::Component>();
+			for (size_t i = 0; i < span.size(); i++)
+				span[i].*Field = data[i];
+		}
+	}
+
+	template <auto Relation, typename TargetIterator>
+	struct JoinSourceCallback
+	{
+		template <typename Source, typename F>
+		static inline void callback(F& f, Arch* arch)
+		{
+			using Relations = typename FieldTraits<decltype(Relation)>::Component;
+			using _targets = tuple_utils::Subset<typename Arch::Cont, IteratorCompatabilityFilter<TargetIterator>>;
+
+			auto sources = arch->template getEntities<Source>();
+			if (sources->size() == 0)
+				return;
+
+			// Type keys are the high bits of Guids, so sorting them puts each
+			// target type's links in one range
+			std::vector<std::pair<Guid, Source*>> links;
+			links.reserve(sources->size());
+			for (Source* source : sources->used_indices)
+			{
+				auto accessor = TypedEntityAccessor<Sys, Source>(source);
+				links.push_back({ accessor.template viewComponent<Relations>()->*Relation, source });
+			}
+			std::sort(links.begin(), links.end(), [] (const auto& a, const auto& b) { return a.first < b.first; });
+
+			tuple_utils::OncePerType<_targets, JoinTargetCallback<Source>>::fn(f, arch, links);
+		}
+	};
+
+	template <typename Source>
+	struct JoinTargetCallback
+	{
+		template <typename Target, typename F>
+		static inline void callback(F& f, Arch* arch, std::vector<std::pair<Guid, Source*>>& links)
+		{
+			static constexpr uint64_t key = indexOf<typename Arch::Cont, Target, EntityBase>();
+			auto targets = arch->template getEntities<Target>();
+
+			auto begin = std::lower_bound(links.begin(), links.end(), key,
+				[] (const auto& link, uint64_t k) { return Arch::typeKey(link.first) < k; });
+			auto end = std::upper_bound(begin, links.end(), key,
+				[] (uint64_t k, const auto& link) { return k < Arch::typeKey(link.first); });
+			if (begin == end)
+				return;
+
+			std::vector<std::pair<Target*, Source*>> pairs;
+			pairs.reserve(end - begin);
+			for (auto link = begin; link != end; ++link)
+			{
+				Target* target = targets->get(Arch::guidId(link->first));
+				if (target != nullptr)
+					pairs.push_back({ target, link->second });
+			}
+			std::sort(pairs.begin(), pairs.end(),
+				[] (const auto& a, const auto& b) { return std::less<Target*>()(a.first, b.first); });
+
+			for (size_t i = 0; i < pairs.size(); i++)
+			{
+				if (i + JOIN_PREFETCH < pairs.size())
+					CZSS_PREFETCH(pairs[i + JOIN_PREFETCH].first);
+
+				auto source = TypedEntityAccessor<Sys, Source>(pairs[i].second);
+				auto target = TypedEntityAccessor<Sys, Target>(pairs[i].first);
+				f(source, target);
+			}
+		}
+	};
+
+	template <typename Iterator>
+	struct TypedChunkCallback
+	{
+		template <typename Value, typename F>
+		static inline void callback(F& f, Arch* arch, size_t maxChunk)
+		{
+			auto ents = arch->template getEntities<Value>();
+			CZSS_CONST_IF (isVirtual<Value>())
+			{
+				for (Value* ent : ents->used_indices)
+				{
+					auto accessor = TypedChunkAccessor<Sys, Value>(ent, 1);
+					f(accessor);
+				}
+			}
+			else
+			{
+				ents->forEachRun(maxChunk, [&] (Value* first, size_t count) {
+					auto accessor = TypedChunkAccessor<Sys, Value>(first, count);
+					f(accessor);
+				});
+			}
+		}
+	};
+
+	struct EntityCountCallback
+	{
+		template <typename Entity>
+		static inline void callback(uint64_t* count, Arch* arch)
+		{
+			auto entities = arch->template getEntities<Entity>();
+			*count += entities->size();
+		}
+	};
+
+	template <typename F>
+	struct ParallelIterateTaskData
+	{
+		uint64_t index = 0;
+		uint64_t beginIndex = 0;
+		uint64_t entityCount = 0;
+		Arch* arch;
+		F* func;
+	};
+
+	template <typename Iterator, typename F, typename Entity>
+	static void iterateOverUsedIndices(ParallelIterateTaskData<F>* data)
+	{
+		auto entities = data->arch->template getEntities<Entity>();
+		auto it = entities->used_indices.begin();
+		it += data->beginIndex;
+
+		auto end = entities->used_indices.end();
+
+		if (data->entityCount < end - it)
+			end = it + data->entityCount;
+
+		uint64_t handled = end - it;
+
+		for (; it != end; it++)
+		{
+			auto accessor = TypedEntityAccessor<Sys, Entity>(*it);
+			F& lambda = *data->func;
+			lambda(data->index, accessor);
+		}
+
+		data->entityCount -= handled;
+		data->beginIndex = 0;
+	}
+
+	template <typename Iterator, typename F>
+	struct TypedParallelIterateTaskCallback
+	{
+		template <typename Value>
+		static inline void callback(ParallelIterateTaskData<F>* data)
+		{
+			auto entities = data->arch->template getEntities<Value>();
+			if (entities->size() == 0 || entities->size() < data->beginIndex)
+			{
+				data->beginIndex -= entities->size();
+				return;
+			}
+
+			iterateOverUsedIndices<Iterator, F, Value>(data);
+		}
+	};
+
+	template <typename Iterator, typename F>
+	static void TypedParallelIterateTask(ParallelIterateTaskData<F>* data)
+	{
+		CZSS_PROFILE_SCOPE(czss::name<Sys>(), "parallelIterate", data->index);
+		CZSS_PERF_SCOPE(Arch, Sys);
+		CZSS_ALLOC_SCOPE(Arch, Sys);
+		using _compat = tuple_utils::Subset<typename Arch::Cont, IteratorCompatabilityFilter<Iterator>>;
+		static constexpr uint64_t limit = std::tuple_size<_compat>::value;
+
+		for (uint64_t i = 0; i < limit; i++)
+		{
+			tuple_utils::Switch<_compat>::template fn<TypedParallelIterateTaskCallback<Iterator, F>>(i, data);
+			if (data->entityCount == 0)
+				return;
+		}
+	}
+
+	template <typename F>
+	struct NodeIterateTaskData
+	{
+		uint64_t index = 0;
+		// Rank of the first entity among live entities of compatible types
+		uint64_t beginRank = 0;
+		uint64_t entityCount = 0;
+		// Compatible type and slot the first entity is in
+		uint64_t type = 0;
+		size_t slot = 0;
+		Arch* arch;
+		F* func;
+	};
+
+	template <typename F>
+	struct NodePartition
+	{
+		NodeIterateTaskData<F>* tasks;
+		uint32_t* nodes;
+		uint64_t numTasks;
+		uint64_t next = 0;
+		uint64_t rank = 0;
+		uint64_t type = 0;
+	};
+
+	// Finds the type and slot of each task's first entity with one pass
+	// over the active bits.
+	struct NodePartitionCallback
+	{
+		template <typename Entity, typename F>
+		static inline void callback(NodePartition<F>* partition, Arch* arch)
+		{
+			static constexpr size_t bits = sizeof(size_t) * 8;
+			auto entities = arch->template getEntities<Entity>();
+			auto& active = entities->active;
+
+			for (size_t w = 0; w < active.size() && partition->next < partition->numTasks; w++)
+			{
+				size_t word = active[w];
+				uint64_t live = std::popcount(word);
+
+				while (partition->next < partition->numTasks
+					&& partition->tasks[partition->next].beginRank < partition->rank + live)
+				{
+					auto& task = partition->tasks[partition->next];
+					for (uint64_t skip = task.beginRank - partition->rank; skip > 0; skip--)
+						word &= word - 1;
+
+					task.type = partition->type;
+					task.slot = w * bits + std::countr_zero(word);
+					partition->nodes[partition->next] = entities->slotNode(task.slot);
+					partition->rank = task.beginRank;
+					live = std::popcount(word);
+					partition->next++;
+				}
+
+				partition->rank += live;
+			}
+
+			partition->type++;
+		}
+	};
+
+	template <typename Iterator, typename F>
+	struct NodeIterateTaskCallback
+	{
+		template <typename Value>
+		static inline void callback(NodeIterateTaskData<F>* data)
+		{
+			auto entities = data->arch->template getEntities<Value>();
+			F& lambda = *data->func;
+			data->entityCount -= entities->forEachActive(data->slot, data->entityCount, [&](Value* ent) {
+				auto accessor = TypedEntityAccessor<Sys, Value>(ent);
+				lambda(data->index, accessor);
+			});
+			data->slot = 0;
+		}
+	};
+
+	template <typename Iterator, typename F>
+	static void NodeIterateTask(NodeIterateTaskData<F>* data)
+	{
+		CZSS_PROFILE_SCOPE(czss::name<Sys>(), "parallelIterate", data->index);
+		CZSS_PERF_SCOPE(Arch, Sys);
+		CZSS_ALLOC_SCOPE(Arch, Sys);
+		using _compat = tuple_utils::Subset<typename Arch::Cont, IteratorCompatabilityFilter<Iterator>>;
+		static constexpr uint64_t limit = std::tuple_size<_compat>::value;
+
+		for (uint64_t i = data->type; i < limit && data->entityCount > 0; i++)
+			tuple_utils::Switch<_compat>::template fn<NodeIterateTaskCallback<Iterator, F>>(i, data);
 	}
 };
 
-template <typename Iter, typename Arch, typename Sys>
-struct IteratorIterator
+
+// #####################################################################
+// Implementation
+// #####################################################################
+
+// #####################
+// Type Validation
+// #####################
+
+
+
+// #####################
+// System
+// #####################
+
+template <typename Sys, typename Other>
+struct SystemExclusiveCheck
+{
+	template <typename Value>
+	static constexpr bool callback()
+	{
+		// Only data types conflict; iterators and permissions are covered by
+		// their flattened components. Other reads the committed copy of a
+		// Buffered component unless it writes it too, so only orchestrating
+		// Sys still conflicts there.
+		return (isComponent<Value>() || isEntity<Value>() || isResource<Value>())
+			&& !(isBuffered<Value>() && !canWrite<Other, Value>() && !canOrchestrate<Sys, Value>())
+			&& ((!isResource<Value>() && canWrite<Sys, Value>())
+				|| (isResource<Value>() && !isThreadSafe<Value>() && canWrite<Sys, Value>()));
+	}
+};
+
+template <typename A, typename B>
+constexpr bool exclusiveWith()
+{
+	return tuple_utils::OncePerType<SystemAccesses<A>, SystemExclusiveCheck<B, A>>::constFn()
+		|| tuple_utils::OncePerType<SystemAccesses<B>, SystemExclusiveCheck<A, B>>::constFn();
+}
+
+template <typename Arch>
+void synchronize(Accessor<Arch, typename Arch::OmniSystem>& arch) {}
+
+} // namespace czss
+
+namespace std {
+template<>
+struct hash<czss::Guid>
+{
+	size_t operator()(const czss::Guid& guid) const noexcept
+	{
+		return std::hash<uint64_t>()(guid.get());
+	}
+};
+
+} // namespace std
+
+#endif // CZSS_HEADERS_H
+
+#ifdef CZSS_IMPLEMENTATION
+
+#ifndef CZSS_IMPLEMENTATION_GUARD_
+#define CZSS_IMPLEMENTATION_GUARD_
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#ifdef CZSS_PERF_COUNTERS
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+namespace czss
+{
+
+Guid::Guid() { }
+
+Guid::Guid(uint64_t v) : id(v) { }
+
+Guid::Guid(const Guid& other) : id(other.id) { }
+
+uint64_t Guid::get() const
+{
+	return id;
+}
+
+bool Guid::operator ==(const Guid& other) const
+{
+	return this->id == other.id;
+}
+
+bool Guid::operator !=(const Guid& other) const
+{
+	return this->id != other.id;
+}
+
+bool Guid::operator <(const Guid& other) const
+{
+	return this->id < other.id;
+}
+
+void TemplateStubs::setGuid(Guid guid) { }
+Guid TemplateStubs::getGuid() const { return Guid(0); }
+
+// #####################
+// Scratch
+// #####################
+
+namespace
+{
+
+struct ScratchPool
+{
+	// Precedes each block, padded to the alignment of the block
+	struct Header
+	{
+		Header* next;
+		size_t size;
+	};
+
+	static_assert(sizeof(Header) <= Scratch::ALIGNMENT, "Scratch header doesn't fit the alignment.");
+	static constexpr size_t MIN_SIZE = 4096;
+
+	SpinLock lock;
+	Header* free = nullptr;
+
+	static ScratchPool& get()
+	{
+		static ScratchPool pool;
+		return pool;
+	}
+};
+
+} // namespace
+
+void* Scratch::acquire(size_t bytes)
+{
+	using Header = ScratchPool::Header;
+	ScratchPool& pool = ScratchPool::get();
+	{
+		// Takes the smallest free block that fits
+		std::lock_guard<SpinLock> lock(pool.lock);
+		Header** best = nullptr;
+		for (Header** link = &pool.free; *link != nullptr; link = &(*link)->next)
+		{
+			if ((*link)->size >= bytes && (best == nullptr || (*link)->size < (*best)->size))
+				best = link;
+		}
+
+		if (best != nullptr)
+		{
+			Header* block = *best;
+			*best = block->next;
+			return reinterpret_cast<char*>(block) + ALIGNMENT;
+		}
+	}
+
+	size_t size = std::bit_ceil(max(bytes, ScratchPool::MIN_SIZE));
+	void* p = ::operator new(ALIGNMENT + size, std::align_val_t(ALIGNMENT));
+	Header* block = new(p) Header { nullptr, size };
+	return reinterpret_cast<char*>(block) + ALIGNMENT;
+}
+
+void Scratch::release(void* p)
+{
+	using Header = ScratchPool::Header;
+	ScratchPool& pool = ScratchPool::get();
+	Header* block = reinterpret_cast<Header*>(reinterpret_cast<char*>(p) - ALIGNMENT);
+
+	std::lock_guard<SpinLock> lock(pool.lock);
+	block->next = pool.free;
+	pool.free = block;
+}
+
+// #####################
+// SIMD kernels
+// #####################
+
+namespace simd
+{
+
+static std::atomic<Isa>& selectedIsa()
+{
+	static std::atomic<Isa> selected { detect() };
+	return selected;
+}
+
+Isa detect()
 {
-	using This = IteratorIterator<Iter, Arch, Sys>;
-	using U = IteratorAccessor<Iter, Arch, Sys>;
+	static Isa detected = [] {
+#ifdef CZSS_SIMD_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f"))
+			return Isa::AVX512;
+		if (__builtin_cpu_supports("avx2"))
+			return Isa::AVX2;
+		if (__builtin_cpu_supports("sse2"))
+			return Isa::SSE;
+#endif
+		return Isa::SCALAR;
+	}();
 
-	typedef uint64_t difference_type;
-	typedef U value_type;
-	typedef U& reference;
-	typedef U* pointer;
-	typedef std::forward_iterator_tag iterator_category;
+	return detected;
+}
 
-	IteratorIterator()
-	{
-		arch = nullptr;
-		typeKey = limit();
-	}
+Isa isa()
+{
+	return selectedIsa().load(std::memory_order_relaxed);
+}
 
-	IteratorIterator(const IteratorIterator& other)
-	{
-		arch = other.arch;
-		typeKey = other.typeKey;
-		index = other.index;
-		maxIndex = other.maxIndex;
-		accessor = other.accessor;
-	}
+void setIsa(Isa isa)
+{
+	selectedIsa().store(isa < detect() ? isa : detect());
+}
 
-	U& operator* ()
+const char* isaName(Isa isa)
+{
+	switch (isa)
 	{
-		return accessor;
+	case Isa::AVX512:
+		return "AVX-512";
+	case Isa::AVX2:
+		return "AVX2";
+	case Isa::SSE:
+		return "SSE2";
+	default:
+		return "scalar";
 	}
+}
 
-	U* operator-> ()
-	{
-		return accessor;
-	}
+} // namespace simd
 
-	friend bool operator== (const This& a, const This& b)
-	{
-		if (a.typeKey >= limit() && b.typeKey >= limit())
-			return true;
+// #####################
+// Profiler
+// #####################
 
-		return a.typeKey == b.typeKey
-			&& a.index == b.index;
-	}
+#ifdef CZSS_PROFILER
+struct Profiler::Ring
+{
+	Event events[RING_SIZE];
+	// Events recorded so far, the ring holds the last RING_SIZE
+	std::atomic<uint64_t> head { 0 };
+	uint32_t thread;
+};
 
-	friend bool operator!= (const This& a, const This& b)
-	{
-		return !(a == b);
-	};
+struct Profiler::Registry
+{
+	std::mutex mutex;
+	// Rings outlive their threads so a dump includes exited ones
+	std::vector<std::unique_ptr<Ring>> rings;
+};
 
-	This operator++(int)
-	{
-		This ret = *this;
-		++(*this);
-		return ret;
-	}
+Profiler::Registry& Profiler::registry()
+{
+	static Registry registry;
+	return registry;
+}
 
-	This& operator++()
+Profiler::Ring& Profiler::ring()
+{
+	static thread_local Ring* ring = nullptr;
+	if (ring == nullptr)
 	{
-		using CompatibleEntities = tuple_utils::Subset<typename Arch::Cont, IteratorCompatabilityFilter<Iter>>;
-		tuple_utils::Switch<CompatibleEntities>::template fn<IncrementerCallback>(typeKey, this);
+		Registry& r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		r.rings.push_back(std::make_unique<Ring>());
+		ring = r.rings.back().get();
+		ring->thread = static_cast<uint32_t>(r.rings.size() - 1);
+	}
 
-		while (index >= maxIndex && typeKey < limit())
-		{
-			typeKey++;
-			if (typeKey < limit())
-				tuple_utils::Switch<CompatibleEntities>::template fn<IncrementerCallback>(typeKey, this);
-		}
+	return *ring;
+}
 
-		return *this;
-	}
+void Profiler::record(const char* name, const char* category, uint64_t begin, uint64_t end, uint64_t arg, bool async)
+{
+	Ring& r = ring();
+	uint64_t head = r.head.load(std::memory_order_relaxed);
+	r.events[head % RING_SIZE] = { name, category, begin, end, arg, async };
+	r.head.store(head + 1, std::memory_order_release);
+}
 
-private:
-	friend IterableStub<Iter, Arch, Sys>;
+uint64_t Profiler::asyncId()
+{
+	static std::atomic<uint64_t> next { uint64_t(1) << 32 };
+	return next.fetch_add(1, std::memory_order_relaxed);
+}
 
-	IteratorIterator(Arch* arch)
+static void appendJsonString(std::string& out, const char* s)
+{
+	out += '"';
+	for (; *s != 0; s++)
 	{
-		this->arch = arch;
-		index = 0;
-		maxIndex = 0;
-		typeKey = 0;
-		++(*this);
+		if (*s == '"' || *s == '\\')
+			out += '\\';
+		if (static_cast<unsigned char>(*s) >= 0x20)
+			out += *s;
 	}
+	out += '"';
+}
 
-	Arch* arch;
-	U accessor;
-	uint64_t index;
-	uint64_t maxIndex;
-	uint64_t typeKey;
+std::string Profiler::chromeTrace()
+{
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
 
-	static constexpr size_t limit()
+	// Timestamps start at the earliest event kept
+	uint64_t origin = std::numeric_limits<uint64_t>::max();
+	for (auto& ring : r.rings)
 	{
-		using CompatibleEntities = tuple_utils::Subset<typename Arch::Cont, IteratorCompatabilityFilter<Iter>>;
-		return std::tuple_size<CompatibleEntities>::value;
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		for (uint64_t i = head > RING_SIZE ? head - RING_SIZE : 0; i < head; i++)
+			origin = min(origin, ring->events[i % RING_SIZE].begin);
 	}
 
-	struct IncrementerCallback
+	std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	char buffer[160];
+	bool first = true;
+
+	for (auto& ring : r.rings)
 	{
-		template <typename Value>
-		static inline void callback(This* iterac)
-		{
-			auto entities = iterac->arch->template getEntities<Value>();
+		snprintf(buffer, sizeof(buffer), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+			first ? "" : ",", ring->thread, ring->thread);
+		out += buffer;
+		first = false;
 
-			if (iterac->index < iterac->maxIndex)
-			{
-				iterac->index++;
-			}
-			else
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		for (uint64_t i = head > RING_SIZE ? head - RING_SIZE : 0; i < head; i++)
+		{
+			const Event& e = ring->events[i % RING_SIZE];
+			if (e.async)
 			{
-				iterac->index = 0;
-				iterac->maxIndex = entities->size();
+				for (int end = 0; end < 2; end++)
+				{
+					out += ",{\"name\":";
+					appendJsonString(out, e.name);
+					out += ",\"cat\":";
+					appendJsonString(out, e.category);
+					snprintf(buffer, sizeof(buffer), ",\"ph\":\"%s\",\"ts\":%.3f,\"id\":%llu,\"pid\":0,\"tid\":%u,\"args\":{\"index\":%llu}}",
+						end ? "e" : "b", ((end ? e.end : e.begin) - origin) / 1000.0, static_cast<unsigned long long>(e.arg),
+						ring->thread, static_cast<unsigned long long>(e.arg));
+					out += buffer;
+				}
+				continue;
 			}
 
-			if (iterac->index < iterac->maxIndex)
-				iterac->accessor = U(entities->used_indices[iterac->index]);
+			out += ",{\"name\":";
+			appendJsonString(out, e.name);
+			out += ",\"cat\":";
+			appendJsonString(out, e.category);
+			snprintf(buffer, sizeof(buffer), ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%u,\"args\":{\"index\":%llu}}",
+				(e.begin - origin) / 1000.0, (e.end - e.begin) / 1000.0, ring->thread, static_cast<unsigned long long>(e.arg));
+			out += buffer;
 		}
-	};
-};
+	}
 
-template <typename Iter, typename Arch, typename Sys>
-struct IterableStub
+	out += "]}\n";
+	return out;
+}
+
+bool Profiler::writeChromeTrace(const char* path)
 {
-	IteratorIterator<Iter, Arch, Sys> begin()
+	FILE* file = fopen(path, "wb");
+	if (file == nullptr)
+		return false;
+
+	std::string trace = chromeTrace();
+	bool written = fwrite(trace.data(), 1, trace.size(), file) == trace.size();
+	return fclose(file) == 0 && written;
+}
+
+void Profiler::clear()
+{
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	for (auto& ring : r.rings)
+		ring->head.store(0, std::memory_order_relaxed);
+}
+#endif
+
+// #####################
+// Performance counters
+// #####################
+
+#ifdef CZSS_PERF_COUNTERS
+namespace
+{
+
+// Counters of one thread, each opened on its own so the ones the machine
+// lacks don't keep the others from counting
+struct PerfThreadCounters
+{
+	int fds[PerfCounters::COUNT];
+	bool any = false;
+
+	PerfThreadCounters()
 	{
-		return IteratorIterator<Iter, Arch, Sys>(arch);
+#ifdef __linux__
+		static const uint64_t configs[PerfCounters::COUNT] = {
+			PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_MISSES,
+			PERF_COUNT_HW_BRANCH_MISSES
+		};
+
+		for (int i = 0; i < PerfCounters::COUNT; i++)
+		{
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = configs[i];
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+
+			fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+			any = any || fds[i] >= 0;
+		}
+#else
+		for (int i = 0; i < PerfCounters::COUNT; i++)
+			fds[i] = -1;
+#endif
 	}
 
-	IteratorIterator<Iter, Arch, Sys> end()
+	~PerfThreadCounters()
 	{
-		return IteratorIterator<Iter, Arch, Sys>();
+#ifdef __linux__
+		for (int fd : fds)
+		{
+			if (fd >= 0)
+				close(fd);
+		}
+#endif
 	}
 
-private:
-	IterableStub(Arch* arch)
+	void read(uint64_t* values) const
 	{
-		this ->arch = arch;
+		for (int i = 0; i < PerfCounters::COUNT; i++)
+		{
+			values[i] = 0;
+#ifdef __linux__
+			if (fds[i] >= 0 && ::read(fds[i], &values[i], sizeof(uint64_t)) != sizeof(uint64_t))
+				values[i] = 0;
+#endif
+		}
 	}
-	friend Accessor<Arch, Sys>;
-	Arch* arch;
 };
 
-template <typename Arch, typename Sys, typename ...Components>
-struct FilterAccessor
+PerfThreadCounters& threadCounters()
 {
-	template <typename F>
-	bool accessEntity(Guid guid, F f)
+	static thread_local PerfThreadCounters counters;
+	return counters;
+}
+
+struct PerfRegistry
+{
+	std::mutex mutex;
+	std::vector<std::unique_ptr<PerfCounters::Totals>> totals;
+
+	static PerfRegistry& get()
 	{
-		return arch->template accessEntityFiltered<Sys, F, Components...>(guid, f);
+		static PerfRegistry registry;
+		return registry;
 	}
-
-private:
-	Arch* arch;
-	FilterAccessor(Arch* arch) : arch(arch) {}
-	friend Accessor<Arch, Sys>;
 };
 
-template <typename Arch, typename Sys, typename ...Components>
-struct ConstFilterAccessor
+} // namespace
+
+bool PerfCounters::available()
 {
-	template <typename F>
-	bool accessEntity(Guid guid, F f) const
-	{
-		return arch->template accessEntityFiltered<Sys, F, Components...>(guid, f);
-	}
+	return threadCounters().any;
+}
 
-private:
-	Arch* arch;
-	ConstFilterAccessor(Arch* arch) : arch(arch) {}
-	friend Accessor<Arch, Sys>;
-};
+PerfScope*& PerfScope::current()
+{
+	static thread_local PerfScope* scopes = nullptr;
+	return scopes;
+}
 
-template<typename Arch, typename Sys>
-struct Accessor
+const void* PerfCounters::read(uint64_t* values)
 {
-	Accessor(const Accessor&) = delete;
-	Accessor(Accessor&&) = delete;
-	Accessor& operator=(const Accessor&) = delete;
-	Accessor& operator=(Accessor&&) = delete;
+	PerfThreadCounters& counters = threadCounters();
+	if (!counters.any)
+		return nullptr;
 
-public:
-	template <typename P>
-	operator Accessor<Arch, P>& ()
-	{
-		canDeriveAssert<Sys, P>();
-		return *reinterpret_cast<Accessor<Arch, P>*>(this);
-	}
+	counters.read(values);
+	return &counters;
+}
 
-	template <typename Entity, typename ...Params>
-	Entity* createEntity(Params&&... params)
-	{
-		entityPermission<Entity>();
-		return arch->template createEntity<Entity>(std::forward<Params>(params)...);
-	}
+PerfCounters::Totals& PerfCounters::add(const char* name)
+{
+	PerfRegistry& r = PerfRegistry::get();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	r.totals.push_back(std::make_unique<Totals>());
+	r.totals.back()->name = name;
+	return *r.totals.back();
+}
 
-	template <typename Entity, typename Context, typename ...Params>
-	Entity* createEntityWithContext(Context&& context, Params&&... params)
-	{
-		entityPermission<Entity>();
-		return arch->template createEntityWithContext<Entity>(context, std::forward(params)...);
-	}
+std::string PerfCounters::report()
+{
+	PerfRegistry& r = PerfRegistry::get();
+	std::lock_guard<std::mutex> lock(r.mutex);
 
-	template <typename Entity>
-	EntityAccessor<Arch, Sys> entityAccessor(const Entity* entity)
-	{
-		return EntityAccessor<Arch, Sys>(entity);
-	}
+	char line[256];
+	std::string out;
+	snprintf(line, sizeof(line), "%-24s %8s %14s %14s %6s %10s %10s\n",
+		"system", "scopes", "cycles", "instructions", "IPC", "LLC MPKI", "br MPKI");
+	out += line;
 
-	EntityAccessor<Arch, Sys> entityAccessor(Guid guid)
+	for (auto& t : r.totals)
 	{
-		void* ptr = arch->getEntity(guid);
-		uint64_t typeKey = Arch::typeKey(guid);
-		return EntityAccessor<Arch, Sys>(typeKey, ptr);
-	}
+		double instructions = double(t->get(INSTRUCTIONS));
+		auto perKilo = [&] (Counter c) { return instructions > 0 ? 1000.0 * t->get(c) / instructions : 0.0; };
 
-	template <typename F>
-	bool accessEntity(Guid guid, F f)
-	{
-		return arch->template accessEntity<Sys>(guid, f);
+		snprintf(line, sizeof(line), "%-24.24s %8llu %14llu %14llu %6.2f %10.3f %10.3f\n",
+			t->name, static_cast<unsigned long long>(t->scopes.load()),
+			static_cast<unsigned long long>(t->get(CYCLES)), static_cast<unsigned long long>(t->get(INSTRUCTIONS)),
+			t->get(CYCLES) > 0 ? instructions / t->get(CYCLES) : 0.0, perKilo(LLC_MISSES), perKilo(BRANCH_MISSES));
+		out += line;
 	}
 
-	template <typename Component, typename F>
-	bool accessComponent(Guid guid, F f)
-	{
-		return arch->template accessComponent<Sys, Component>(guid, f);
-	}
+	return out;
+}
 
-	template <typename ...Components>
-	FilterAccessor<Arch, Sys, Components...> filterEntities()
+void PerfCounters::reset()
+{
+	PerfRegistry& r = PerfRegistry::get();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	for (auto& t : r.totals)
 	{
-		return FilterAccessor<Arch, Sys, Components...>(arch);
+		for (auto& value : t->values)
+			value.store(0, std::memory_order_relaxed);
+		t->scopes.store(0, std::memory_order_relaxed);
 	}
+}
+#endif
 
-	template <typename ...Components>
-	ConstFilterAccessor<Arch, Sys, Components...> filterEntitiesConst() const
-	{
-		return ConstFilterAccessor<Arch, Sys, Components...>(arch);
-	}
+// #####################
+// Allocation counters
+// #####################
 
-	template <typename Entity>
-	const Entity* viewEntity(Guid guid) const
+#ifdef CZSS_ALLOC_COUNTERS
+namespace
+{
+
+struct AllocThreadCounts
+{
+	uint64_t allocations;
+	uint64_t bytes;
+};
+
+// Plain data, so operator new can count before the thread's first
+// dynamic initialisation
+thread_local AllocThreadCounts allocThreadCounts = { 0, 0 };
+std::atomic<uint64_t> allocTotal { 0 };
+
+struct AllocRegistry
+{
+	std::mutex mutex;
+	std::vector<std::unique_ptr<AllocCounters::Totals>> totals;
+
+	static AllocRegistry& get()
 	{
-		static_assert(isEntity<Entity>(), "Attempted to create non-entity.");
-		tuple_utils::OncePerType<Flatten<typename Entity::Cont>, HasEntityReadPermissionCallback<Sys>>::fn();
-		static_assert(inspect::contains<typename Arch::Cont, Entity>(), "Architecture doesn't contain the Entity.");
-		return arch->template getEntity<Entity>(guid);
+		static AllocRegistry registry;
+		return registry;
 	}
+};
+
+} // namespace
+
+void AllocCounters::count(size_t bytes)
+{
+	allocThreadCounts.allocations++;
+	allocThreadCounts.bytes += bytes;
+	allocTotal.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t AllocCounters::total()
+{
+	return allocTotal.load(std::memory_order_relaxed);
+}
+
+const void* AllocCounters::read(uint64_t* allocations, uint64_t* bytes)
+{
+	*allocations = allocThreadCounts.allocations;
+	*bytes = allocThreadCounts.bytes;
+	return &allocThreadCounts;
+}
+
+AllocCounters::Totals& AllocCounters::add(const char* name)
+{
+	AllocRegistry& r = AllocRegistry::get();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	r.totals.push_back(std::make_unique<Totals>());
+	r.totals.back()->name = name;
+	return *r.totals.back();
+}
+
+std::string AllocCounters::report()
+{
+	AllocRegistry& r = AllocRegistry::get();
+	std::lock_guard<std::mutex> lock(r.mutex);
+
+	char line[256];
+	std::string out;
+	snprintf(line, sizeof(line), "%-24s %8s %12s %14s %12s\n", "system", "scopes", "allocations", "bytes", "per scope");
+	out += line;
 
-	template <typename Entity>
-	const Entity* viewEntity(EntityId<Arch, Entity> id) const
+	for (auto& t : r.totals)
 	{
-		static_assert(isEntity<Entity>(), "Attempted to create non-entity.");
-		tuple_utils::OncePerType<Flatten<typename Entity::Cont>, HasEntityReadPermissionCallback<Sys>>::fn();
-		static_assert(inspect::contains<typename Arch::Cont, Entity>(), "Architecture doesn't contain the Entity.");
-		return arch->template getEntity<Entity>(id);
+		uint64_t scopes = t->scopes.load();
+		uint64_t allocations = t->allocations.load();
+		snprintf(line, sizeof(line), "%-24.24s %8llu %12llu %14llu %12.2f\n",
+			t->name, static_cast<unsigned long long>(scopes), static_cast<unsigned long long>(allocations),
+			static_cast<unsigned long long>(t->bytes.load()), scopes > 0 ? double(allocations) / scopes : 0.0);
+		out += line;
 	}
 
-	template <typename Entity>
-	Entity* getEntity(Guid guid)
-	{
-		static_assert(isEntity<Entity>(), "Attempted to create non-entity.");
-		tuple_utils::OncePerType<Flatten<typename Entity::Cont>, HasEntityWritePermissionCallback<Sys>>::fn();
-		static_assert(inspect::contains<typename Arch::Cont, Entity>(), "Architecture doesn't contain the Entity.");
-		return arch->template getEntity<Entity>(guid);
-	}
+	return out;
+}
 
-	template <typename Entity>
-	Entity* getEntity(EntityId<Arch, Entity> id)
+void AllocCounters::reset()
+{
+	AllocRegistry& r = AllocRegistry::get();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	for (auto& t : r.totals)
 	{
-		static_assert(isEntity<Entity>(), "Attempted to create non-entity.");
-		tuple_utils::OncePerType<Flatten<typename Entity::Cont>, HasEntityWritePermissionCallback<Sys>>::fn();
-		static_assert(inspect::contains<typename Arch::Cont, Entity>(), "Architecture doesn't contain the Entity.");
-		return arch->template getEntity<Entity>(id);
+		t->allocations.store(0, std::memory_order_relaxed);
+		t->bytes.store(0, std::memory_order_relaxed);
+		t->scopes.store(0, std::memory_order_relaxed);
 	}
+}
+#endif
 
-	template <typename Entity>
-	EntityId<Arch, Entity> getEntityId(const Entity* ent) const
-	{
-		return Arch::getEntityId(ent);
-	}
+// #####################
+// Topology
+// #####################
 
-	void destroyEntity(Guid guid)
-	{
-		if (tuple_utils::OncePerType<typename Arch::Cont, EntityDestructionPermission>::constFn(Arch::typeKey(guid)))
+uint32_t Topology::nodeOf(uint32_t cpu) const
+{
+	return cpu < cpuNodes.size() ? cpuNodes[cpu] : 0;
+}
+
+const Topology& Topology::get()
+{
+	static Topology topology = [] {
+		Topology t;
+		uint32_t n = std::thread::hardware_concurrency();
+		t.cpuNodes.resize(n == 0 ? 1 : n, 0);
+
+#ifdef __linux__
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		sched_getaffinity(0, sizeof(allowed), &allowed);
+
+		std::vector<uint32_t> nodeIds;
+		if (DIR* dir = opendir("/sys/devices/system/node"))
 		{
-			arch->template destroyEntity<Sys>(guid);
+			while (dirent* entry = readdir(dir))
+			{
+				unsigned id;
+				if (sscanf(entry->d_name, "node%u", &id) == 1)
+					nodeIds.push_back(id);
+			}
+			closedir(dir);
 		}
-	}
+		std::sort(nodeIds.begin(), nodeIds.end());
 
-	template <typename Entity>
-	void destroyEntity(EntityId<Arch, Entity> key)
-	{
-		static_assert(Sys::template canOrchestrate<Entity>(), "System does not have the permission to destroy this entity.");
-		arch->template destroyEntity<Sys>(key);
-	}
+		// Nodes are renumbered densely, cpulist reads like "0-3,8-11"
+		for (uint32_t node = 0; node < nodeIds.size(); node++)
+		{
+			std::string path = "/sys/devices/system/node/node" + std::to_string(nodeIds[node]) + "/cpulist";
+			FILE* file = fopen(path.c_str(), "r");
+			if (file == nullptr)
+				continue;
 
-	template <typename ...Entities>
-	void destroyEntities()
-	{
-		tuple_utils::OncePerType<Rbox<Entities...>, EntityOrchestrationPermissionTest>::fn();
-		arch->template destroyEntities<Entities...>();
-	}
+			unsigned first, last;
+			while (fscanf(file, "%u", &first) == 1)
+			{
+				last = first;
+				if (fscanf(file, "-%u", &last) != 1)
+					last = first;
+				for (uint32_t cpu = first; cpu <= last; cpu++)
+				{
+					if (cpu >= t.cpuNodes.size())
+						t.cpuNodes.resize(cpu + 1, 0);
+					t.cpuNodes[cpu] = node;
+				}
+				if (fgetc(file) != ',')
+					break;
+			}
+			fclose(file);
+		}
 
-	struct MiniRunMapper
-	{
-		template <typename V>
-		struct MrmImpl
+		for (uint32_t node = 0; node < max(uint32_t(nodeIds.size()), uint32_t(1)); node++)
 		{
-			using type = V;
-			using fn = V;
-		};
+			for (uint32_t cpu = 0; cpu < t.cpuNodes.size(); cpu++)
+			{
+				if (t.cpuNodes[cpu] == node && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+					t.cpus.push_back(cpu);
+			}
+		}
+#endif
 
-		template <typename A, typename S>
-		struct MrmImpl<void(*)(Accessor<A, S>)>
+		if (t.cpus.empty())
 		{
-			using type = S;
-			using fn = void(*)(Accessor<A, S>);
-		};
+			for (uint32_t cpu = 0; cpu < t.cpuNodes.size(); cpu++)
+				t.cpus.push_back(cpu);
+		}
 
-		template <typename A, typename S>
-		struct MrmImpl<void(*)(Accessor<A, S>&)>
-		{
-			using type = S;
-			using fn = void(*)(Accessor<A, S>&);
-		};
+		t.nodes = 1;
+		for (uint32_t cpu : t.cpus)
+			t.nodes = max(t.nodes, t.cpuNodes[cpu] + 1);
 
-		template <typename A, typename S>
-		struct MrmImpl<void(*)(const Accessor<A, S>&)>
-		{
-			using type = S;
-			using fn = void(*)(const Accessor<A, S>&);
-		};
+		return t;
+	}();
 
-		template <typename V>
-		using type = typename MrmImpl<V>::type;
+	return topology;
+}
 
-		template <typename V>
-		using fn = typename MrmImpl<V>::fn;
-	};
+bool pinThread(uint32_t cpu)
+{
+#ifdef __linux__
+	if (cpu >= CPU_SETSIZE)
+		return false;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
 
-	template <std::size_t I, typename A>
-	struct MiniRunFilter
-	{
-		template <typename V>
-		struct FilterImpl;
+uint32_t currentNode()
+{
+#ifdef __linux__
+	int cpu = sched_getcpu();
+	if (cpu >= 0)
+		return Topology::get().nodeOf(cpu);
+#endif
+	return 0;
+}
 
-		template <std::size_t J, typename B>
-		struct FilterImpl<std::tuple< std::integral_constant<std::size_t, J>, B >>
-		{
-			static constexpr bool value = (J < I) && exclusiveWith<A, B>();
-		};
+// #####################
+// CzsfBackend
+// #####################
 
-		template <typename V>
-		static constexpr bool test()
-		{
-			return FilterImpl<V>::value;
-		}
-	};
+#ifndef CZSS_BACKEND_THREAD_POOL
 
-	struct MinirunTaskData
-	{
-		czsf::Barrier* barriers;
-		void (*fn) (void*);
-		Accessor<Arch, Sys>* arch;
-		size_t i;
-	};
+struct CzsfBackend::State
+{
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::atomic<uint64_t> submissions { 0 };
+	std::atomic<uint32_t> activities { 0 };
+	std::atomic<uint32_t> parked { 0 };
 
-	template <size_t I, typename Others, typename P>
-	static void _minirun(MinirunTaskData* task)
+	void notify()
 	{
-		using _s = typename MiniRunMapper::template type<P>;
-		using _filt = tuple_utils::Subset<Others, MiniRunFilter<I, _s>>;
+		std::lock_guard<std::mutex> lock(mutex);
+		cv.notify_all();
+	}
+};
 
-		// Redundant waits here
-		tuple_utils::oncePerType2<_filt>([&] <typename O> () {
-			auto i = std::tuple_element<0, O>::type::value;
-			task->barriers[i].wait();
-		});
+uint32_t CzsfBackend::spinCount = 1024;
+std::chrono::microseconds CzsfBackend::parkTimeout(1000);
 
-		auto fn = reinterpret_cast<typename MiniRunMapper::template fn<P>>(task->fn);
-		fn(*task->arch);
-	}
+CzsfBackend::State& CzsfBackend::state()
+{
+	static State s;
+	return s;
+}
 
-	template <typename ...S>
-	void minirun(S... fn)
-	{
-		using _systems = tuple_utils::Map<std::tuple<S...>, MiniRunMapper>;
-		using _numbered = tuple_utils::Numbered<_systems>;
+void CzsfBackend::wake()
+{
+	State& s = state();
+	s.submissions.fetch_add(1);
+	if (s.parked.load() > 0)
+		s.notify();
+}
 
-		static constexpr size_t N = sizeof...(S);
-		auto pointers = std::tuple(fn...);
+void CzsfBackend::beginActivity()
+{
+	State& s = state();
+	if (s.activities.fetch_add(1) == 0 && s.parked.load() > 0)
+		s.notify();
+}
 
-		std::vector<czsf::Barrier> barriers(N);
-		std::vector<MinirunTaskData> taskData(N);
+void CzsfBackend::endActivity()
+{
+	state().activities.fetch_sub(1);
+}
 
-		for (size_t i = 0; i < N; i++)
-			new(&barriers[i]) czsf::Barrier(1);
+void CzsfBackend::work(const volatile bool& exiting)
+{
+	State& s = state();
+	uint64_t seen = s.submissions.load();
+	uint32_t idle = 0;
 
-		tuple_utils::oncePerType2<_numbered>([&] <typename P> () {
-			static constexpr size_t I = std::tuple_element<0, P>::type::value;
+	while (!exiting)
+	{
+		czsf_yield();
 
-			taskData[I].barriers = barriers.data();
-			taskData[I].fn = reinterpret_cast<void(*)(void*)> (std::get<I>(pointers));
-			taskData[I].arch = this;
-			taskData[I].i = I;
-			czsf::run(_minirun<I, _numbered, typename std::tuple_element<I, decltype(pointers)>::type>, &taskData[I], 1, &barriers[I]);
+		uint64_t submissions = s.submissions.load(std::memory_order_acquire);
+		if (submissions != seen || s.activities.load() > 0)
+		{
+			seen = submissions;
+			idle = 0;
+			continue;
+		}
+
+		if (++idle < spinCount)
+			continue;
+
+		std::unique_lock<std::mutex> lock(s.mutex);
+		s.parked++;
+		bool woken = s.cv.wait_for(lock, parkTimeout, [&] {
+			return exiting || s.activities.load() > 0 || s.submissions.load() != seen;
 		});
+		s.parked--;
 
-		for (size_t i = 0; i < N; i++)
-			barriers[i].wait();
+		// After a timeout, yield once for unknown tasks and park again
+		if (woken)
+			idle = 0;
 	}
+}
 
+#ifdef CZSS_PERF_COUNTERS
+void CzsfBackend::Barrier::wait()
+{
+	CZSS_PERF_PAUSE();
+	czsf::Barrier::wait();
+}
+#endif
 
-	template <typename Resource>
-	const Resource* viewResource() const
-	{
-		static_assert(isResource<Resource>(), "Attempted to read non-resource.");
-		static_assert(canRead<Sys, Resource>(), "System lacks permission to read Resource.");
-		static_assert(inspect::contains<typename Arch::Cont, Resource>(), "Architecture doesn't contain the Resource.");
-		return arch->template getResource<Resource>();
-	}
+#endif
 
-	template <typename Resource>
-	Resource* getResource()
-	{
-		static_assert(isResource<Resource>(), "Attempted to write to non-resource.");
-		static_assert(canWrite<Sys, Resource>(), "System lacks permission to modify Resource.");
-		static_assert(inspect::contains<typename Arch::Cont, Resource>(), "Architecture doesn't contain the Resource.");
-		return arch->template getResource<Resource>();
-	}
+// #####################
+// ThreadPool
+// #####################
 
-	// TODO add special permission?
-	template <typename Resource>
-	void setResource(Resource* res)
+struct ThreadPool::State
+{
+	struct Task
 	{
-		static_assert(isResource<Resource>(), "Attempted to write to non-resource.");
-		static_assert(canWrite<Sys, Resource>(), "System lacks permission to modify Resource.");
-		static_assert(inspect::contains<typename Arch::Cont, Resource>(), "Architecture doesn't contain the Resource.");
-		arch->setResource(res);
-	}
+		void (*fn)(void*);
+		void* data;
+		Barrier* barrier;
+	};
 
-	template <typename Iterator>
-	IterableStub<Iterator, Arch, Sys> iterate()
+	// Ring buffer deque, grows but never shrinks
+	struct Queue
 	{
-		iteratorPermission<Iterator>();
-		return IterableStub<Iterator, Arch, Sys>(arch);
-	}
+		std::mutex mutex;
+		std::vector<Task> ring;
+		size_t head = 0;
+		size_t size = 0;
 
-	template <typename ...Values>
-	IterableStub<Iterator<Values...>, Arch, Sys> iterate2()
-	{
-		return iterate<Iterator<Values...>>();
-	}
+		void push(const Task& task)
+		{
+			if (size == ring.size())
+			{
+				std::vector<Task> next(ring.size() == 0 ? 64 : ring.size() * 2);
+				for (size_t i = 0; i < size; i++)
+					next[i] = ring[(head + i) % ring.size()];
+				ring.swap(next);
+				head = 0;
+			}
 
-	template <typename Iterator, typename F>
-	void iterate(F f)
-	{
-		using _compat = tuple_utils::Subset<typename Arch::Cont, IteratorCompatabilityFilter<Iterator>>;
-		iteratorPermission<Iterator>();
+			ring[(head + size) % ring.size()] = task;
+			size++;
+		}
 
-		tuple_utils::OncePerType<_compat, TypedIteratorCallback<Iterator>>::fn(f, arch);
-	}
+		bool popBack(Task& task)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (size == 0)
+				return false;
+			size--;
+			task = ring[(head + size) % ring.size()];
+			return true;
+		}
 
-	template <typename Iterator, typename F>
-	void parallelIterate(uint64_t numTasks, F f)
-	{
-		parallelIterateImpl<Iterator>(numTasks, f, TypedParallelIterateTask<Iterator, F>);
-	}
+		bool popFront(Task& task)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (size == 0)
+				return false;
+			task = ring[head];
+			head = (head + 1) % ring.size();
+			size--;
+			return true;
+		}
+	};
 
-	template <typename Iterator>
-	uint64_t countCompatibleEntities()
-	{
-		uint64_t entityCount = 0;
-		using _compat = tuple_utils::Subset<typename Arch::Cont, IteratorCompatabilityFilter<Iterator>>;
-		tuple_utils::OncePerType<_compat, EntityCountCallback>::fn(&entityCount, arch);
-		return entityCount;
-	}
+	Queue queues[MAX_WORKERS];
+	Queue shared;
+	std::thread threads[MAX_WORKERS];
 
-// private:
-	// friend Arch;
-	Accessor(Arch* arch) { this->arch = arch; }
-	Arch* arch;
+	std::mutex mutex;
+	// Sleeping workers wait for tasks on cv, parked ones for a blocked
+	// worker to stand in for on parkCv, so waking one never wakes the other
+	std::condition_variable cv;
+	std::condition_variable parkCv;
+	std::atomic<uint32_t> workers { 0 };
+	std::atomic<uint32_t> target { 0 };
+	std::atomic<uint32_t> blocked { 0 };
+	std::atomic<uint32_t> sleeping { 0 };
+	// Compensation workers parked once the workers they stood in for are
+	// no longer blocked
+	std::atomic<uint32_t> parked { 0 };
+	std::atomic<uint64_t> pending { 0 };
+	std::atomic<bool> stopping { false };
 
-private:
-	template <typename Iterator, typename F, typename CB>
-	void parallelIterateImpl(uint64_t numTasks, F f, CB* cb)
+	bool pinned = false;
+	std::atomic<bool> placement { false };
+	uint32_t workerNodes[MAX_WORKERS] = { };
+	// Workers started on each node, compensation workers aren't included
+	std::vector<std::vector<uint32_t>> nodeWorkers;
+	std::atomic<uint32_t> roundRobin { 0 };
+
+	// Idle time of each worker up to idleSince, when its current idle
+	// stretch began, 0 while it runs a task
+	std::atomic<uint64_t> idleTotal[MAX_WORKERS] = { };
+	std::atomic<uint64_t> idleSince[MAX_WORKERS] = { };
+
+	static thread_local uint32_t current;
+	static constexpr uint32_t NOT_A_WORKER = ~uint32_t(0);
+	static constexpr uint32_t SPIN_COUNT = 256;
+
+
+	~State()
 	{
-		iteratorPermission<Iterator>();
-		uint64_t counter = countCompatibleEntities<Iterator>();
+		ThreadPool::stop();
+	}
 
-		std::vector<ParallelIterateTaskData<F>> taskvec(numTasks);
-		ParallelIterateTaskData<F>* tasks = taskvec.data();
+	bool take(uint32_t self, Task& task)
+	{
+		if (pending.load(std::memory_order_acquire) == 0)
+			return false;
 
-		for (uint64_t i = 0; i < numTasks; i++)
-		{
-			tasks[i].index = i;
-			tasks[i].arch = arch;
-			tasks[i].func = &f;
-			tasks[i].entityCount = min(counter, max(uint64_t(1), counter / (numTasks - i)));
-			counter -= tasks[i].entityCount;
+		if (self != NOT_A_WORKER && queues[self].popBack(task))
+			return taken();
 
-			if (i > 0)
-			{
-				tasks[i].beginIndex = tasks[i - 1].beginIndex + tasks[i - 1].entityCount;
-			}
+		if (shared.popFront(task))
+			return taken();
 
-			if (counter == 0)
-			{
-				numTasks = i + 1;
-				break;
-			}
+		uint32_t count = workers.load(std::memory_order_acquire);
+		for (uint32_t i = 1; i <= count; i++)
+		{
+			uint32_t victim = (self + i) % count;
+			if (victim != self && queues[victim].popFront(task))
+				return taken();
 		}
 
-		czsf::Barrier barrier(numTasks);
-		czsf::run(cb, tasks, numTasks, &barrier);
-		barrier.wait();
+		return false;
 	}
 
-	template <typename Iterator>
-	static void iteratorPermission()
+	bool taken()
 	{
-		static_assert(isIterator<Iterator>(), "Attempted to iterate non-iterator.");
-		static_assert(inspect::containsAllIn<SystemAccesses<Sys>, typename Iterator::Cont>(), "System doesn't have access to all components of Iterator.");
+		pending.fetch_sub(1, std::memory_order_acq_rel);
+		return true;
 	}
 
-	template <typename Entity>
-	static void entityPermission()
+	static void execute(const Task& task)
 	{
-		static_assert(isEntity<Entity>(), "Attempted to orchestrate non-entity.");
-		static_assert(canOrchestrate<Sys, Entity>(), "System lacks permission to orchestrate the Entity.");
-		// static_assert(inspect::contains<typename Arch::Cont, Entity>(), "Architecture doesn't contain the Entity.");
+		task.fn(task.data);
+		if (task.barrier != nullptr)
+			task.barrier->signal();
 	}
 
-	struct EntityDestructionPermission
+	void wake(uint64_t count)
 	{
-		template <typename Value>
-		static constexpr bool callback(const uint64_t& key)
-		{
-			return isEntity<Value>()
-				&& indexOf<typename Arch::Cont, Value, EntityBase>() == key
-				&& canOrchestrate<Sys, Value>();
-		}
-	};
+		if (sleeping.load() == 0)
+			return;
 
-	struct EntityOrchestrationPermissionTest
-	{
-		template <typename V>
-		static void callback()
-		{
-			entityPermission<V>();
-		}
-	};
+		std::lock_guard<std::mutex> lock(mutex);
+		if (count == 1)
+			cv.notify_one();
+		else
+			cv.notify_all();
+	}
 
-	template <typename Other, typename Systems>
-	struct SystemAccessValidationCallback
+	void work(uint32_t self)
 	{
-		template <typename Value>
-		static void callback()
+		current = self;
+		Task task;
+		uint32_t spins = 0;
+
+		while (true)
 		{
-			#define ErrorMessage "System running other systems via accessor must have all permissions of the systems being run."
+			if (self >= target.load() && running() > target.load())
+				park();
 
-			CZSS_CONST_IF (isComponent<Value>())
+			if (take(self, task))
 			{
-				CZSS_CONST_IF (canRead<Other, Value>())
-					static_assert(canRead<Sys, Value>(), ErrorMessage);
+				uint64_t since = idleSince[self].exchange(0, std::memory_order_relaxed);
+				if (since != 0)
+					idleTotal[self].fetch_add(nanoTime() - since, std::memory_order_relaxed);
 
-				CZSS_CONST_IF (canWrite<Other, Value>())
-					static_assert(canWrite<Sys, Value>(), ErrorMessage);
+				execute(task);
+				spins = 0;
+				continue;
 			}
 
-			CZSS_CONST_IF (isEntity<Value>())
+			if (spins == 0 && idleSince[self].load(std::memory_order_relaxed) == 0)
+				idleSince[self].store(nanoTime(), std::memory_order_relaxed);
+
+			if (spins++ < SPIN_COUNT)
 			{
-				CZSS_CONST_IF (canOrchestrate<Other, Value>())
-					static_assert(canOrchestrate<Sys, Value>(), ErrorMessage);
+				std::this_thread::yield();
+				continue;
 			}
 
-			#undef ErrorMessage
+			std::unique_lock<std::mutex> lock(mutex);
+			if (stopping.load())
+				return;
 
-			CZSS_CONST_IF (isSystem<Value>())
-			{
-				static_assert(!inspect::contains<Arch::Cont, Value>(), "Subsystems must not refer any types in the architecture");
-				static_assert(inspect::contains<Systems, Value>(), "Subsystem run must include all dependencies.");
-			}
+			sleeping++;
+			cv.wait(lock, [&] { return pending.load() > 0 || stopping.load(); });
+			sleeping--;
+			spins = 0;
 		}
-	};
+	}
 
-	template <typename Systems>
-	struct SystemsRunPermissionTest
+	// Workers neither blocked nor parked
+	uint32_t running() const
 	{
-		template <typename V>
-		static void callback()
-		{
-			static_assert(isSystem<V>(), "Only systems allowed as template parameters.");
-			static_assert(!inspect::contains<Arch::Cont, V>(), "Architecture must not refer to system.");
-			typename V::Cont::template evaluate<tuple_utils::OncePerType<Dummy, SystemAccessValidationCallback<V, Systems>>>();
-		}
-	};
+		return workers.load() - blocked.load() - parked.load();
+	}
 
-	template <typename Iterator>
-	struct TypedIteratorCallback
+	// Waits until a blocked worker needs standing in for
+	void park()
 	{
-		template <typename Value, typename F>
-		static inline void callback(F& f, Arch* arch)
-		{
-			CZSS_CONST_IF (isEntity<Value>() && isIteratorCompatibleWithEntity<Iterator, Value>())
-			{
-				auto ents = arch->template getEntities<Value>();
-				for (auto& ent : ents->used_indices)
-				{
-					auto accessor = TypedEntityAccessor<Sys, Value>(ent);
-					f(accessor);
-				}
-			}
-		}
-	};
+		std::unique_lock<std::mutex> lock(mutex);
+		if (running() <= target.load())
+			return;
 
-	struct EntityCountCallback
+		parked++;
+		parkCv.wait(lock, [&] { return stopping.load() || running() < target.load(); });
+		parked--;
+	}
+
+	// Caller holds mutex. Returns false when MAX_WORKERS are running.
+	bool spawn()
 	{
-		template <typename Entity>
-		static inline void callback(uint64_t* count, Arch* arch)
+		uint32_t index = workers.load();
+		if (index >= MAX_WORKERS)
+			return false;
+
+		uint32_t cpu = 0;
+		if (pinned)
 		{
-			auto entities = arch->template getEntities<Entity>();
-			*count += entities->size();
+			const Topology& topology = Topology::get();
+			cpu = topology.cpus[index % topology.cpus.size()];
+			workerNodes[index] = topology.nodeOf(cpu);
 		}
-	};
 
-	template <typename F>
-	struct ParallelIterateTaskData
-	{
-		uint64_t index = 0;
-		uint64_t beginIndex = 0;
-		uint64_t entityCount = 0;
-		Arch* arch;
-		F* func;
-	};
+		threads[index] = std::thread([this, index, cpu] {
+			if (pinned)
+				pinThread(cpu);
+			work(index);
+		});
+		workers.store(index + 1, std::memory_order_release);
+		return true;
+	}
 
-	template <typename Iterator, typename F, typename Entity>
-	static void iterateOverUsedIndices(ParallelIterateTaskData<F>* data)
+	void ensureStarted()
 	{
-		auto entities = data->arch->template getEntities<Entity>();
-		auto it = entities->used_indices.begin();
-		it += data->beginIndex;
+		if (workers.load(std::memory_order_acquire) > 0)
+			return;
 
-		auto end = entities->used_indices.end();
+		uint32_t n = std::thread::hardware_concurrency();
+		ThreadPool::start(n == 0 ? 1 : n);
+	}
+};
 
-		if (data->entityCount < end - it)
-			end = it + data->entityCount;
+thread_local uint32_t ThreadPool::State::current = ThreadPool::State::NOT_A_WORKER;
 
-		uint64_t handled = end - it;
+ThreadPool::State& ThreadPool::state()
+{
+	static State s;
+	return s;
+}
 
-		for (; it != end; it++)
-		{
-			auto accessor = TypedEntityAccessor<Sys, Entity>(*it);
-			F& lambda = *data->func;
-			lambda(data->index, accessor);
-		}
+void ThreadPool::start(uint32_t count, bool pin)
+{
+	State& s = state();
+	std::lock_guard<std::mutex> lock(s.mutex);
+	if (s.workers.load() > 0)
+		return;
 
-		data->entityCount -= handled;
-		data->beginIndex = 0;
+	s.stopping = false;
+	s.pinned = pin;
+	s.target = min(max(count, uint32_t(1)), MAX_WORKERS);
+	s.nodeWorkers.assign(Topology::get().nodes, {});
+	for (uint32_t i = 0; i < s.target; i++)
+	{
+		s.workerNodes[i] = 0;
+		s.spawn();
+		s.nodeWorkers[s.workerNodes[i]].push_back(i);
 	}
+}
 
-	template <typename Iterator, typename F>
-	struct TypedParallelIterateTaskCallback
+void ThreadPool::stop()
+{
+	State& s = state();
 	{
-		template <typename Value>
-		static inline void callback(ParallelIterateTaskData<F>* data)
-		{
-			auto entities = data->arch->template getEntities<Value>();
-			if (entities->size() == 0 || entities->size() < data->beginIndex)
-			{
-				data->beginIndex -= entities->size();
-				return;
-			}
-
-			iterateOverUsedIndices<Iterator, F, Value>(data);
-		}
-	};
+		std::lock_guard<std::mutex> lock(s.mutex);
+		s.stopping = true;
+		s.cv.notify_all();
+		s.parkCv.notify_all();
+	}
 
-	template <typename Iterator, typename F>
-	static void TypedParallelIterateTask(ParallelIterateTaskData<F>* data)
+	uint32_t count = s.workers.load();
+	for (uint32_t i = 0; i < count; i++)
 	{
-		using _compat = tuple_utils::Subset<typename Arch::Cont, IteratorCompatabilityFilter<Iterator>>;
-		static constexpr uint64_t limit = std::tuple_size<_compat>::value;
-
-		for (uint64_t i = 0; i < limit; i++)
-		{
-			tuple_utils::Switch<_compat>::template fn<TypedParallelIterateTaskCallback<Iterator, F>>(i, data);
-			if (data->entityCount == 0)
-				return;
-		}
+		if (s.threads[i].joinable())
+			s.threads[i].join();
 	}
-};
 
+	std::lock_guard<std::mutex> lock(s.mutex);
+	s.workers = 0;
+}
+
+uint32_t ThreadPool::workerCount()
+{
+	return state().workers.load();
+}
 
-// #####################################################################
-// Implementation
-// #####################################################################
+uint32_t ThreadPool::workerNode(uint32_t worker)
+{
+	return worker < MAX_WORKERS ? state().workerNodes[worker] : 0;
+}
 
-// #####################
-// Type Validation
-// #####################
+uint64_t ThreadPool::idleTime(uint32_t worker)
+{
+	if (worker >= MAX_WORKERS)
+		return 0;
 
+	State& s = state();
+	uint64_t since = s.idleSince[worker].load(std::memory_order_relaxed);
+	uint64_t total = s.idleTotal[worker].load(std::memory_order_relaxed);
+	return since == 0 ? total : total + (nanoTime() - since);
+}
 
+uint32_t ThreadPool::numaNodes()
+{
+	State& s = state();
+	if (!s.placement.load() || !s.pinned)
+		return 1;
+
+	uint32_t used = 0;
+	for (auto& workers : s.nodeWorkers)
+		used += workers.empty() ? 0 : 1;
+	return used > 1 ? static_cast<uint32_t>(s.nodeWorkers.size()) : 1;
+}
 
-// #####################
-// System
-// #####################
+void ThreadPool::setNumaPlacement(bool enabled)
+{
+	state().placement.store(enabled);
+}
 
-template <typename Sys>
-struct SystemExclusiveCheck
+void ThreadPool::touchOnNode(void* p, size_t bytes, uint32_t node)
 {
-	template <typename Value>
-	static constexpr bool callback()
+#ifdef __linux__
+	// Migrate to the node for the duration of the writes
+	const Topology& topology = Topology::get();
+	cpu_set_t previous, set;
+	CPU_ZERO(&set);
+	for (uint32_t cpu : topology.cpus)
 	{
-		return (!isResource<Value>() && canWrite<Sys, Value>())
-			|| (isResource<Value>() && !isThreadSafe<Value>() && canWrite<Sys, Value>());
+		if (topology.nodeOf(cpu) == node && cpu < CPU_SETSIZE)
+			CPU_SET(cpu, &set);
 	}
-};
 
-template <typename A, typename B>
-constexpr bool exclusiveWith()
-{
-	return tuple_utils::OncePerType<SystemAccesses<A>, SystemExclusiveCheck<B>>::constFn()
-		|| tuple_utils::OncePerType<SystemAccesses<B>, SystemExclusiveCheck<A>>::constFn();
-}
+	pthread_t self = pthread_self();
+	bool moved = CPU_COUNT(&set) > 0
+		&& pthread_getaffinity_np(self, sizeof(previous), &previous) == 0
+		&& pthread_setaffinity_np(self, sizeof(set), &set) == 0;
 
-template <typename Arch>
-void synchronize(Accessor<Arch, typename Arch::OmniSystem>& arch) {}
+	memset(p, 0, bytes);
 
-} // namespace czss
+	if (moved)
+		pthread_setaffinity_np(self, sizeof(previous), &previous);
+#endif
+}
 
-namespace std {
-template<>
-struct hash<czss::Guid>
+void ThreadPool::submit(void (*fn)(void*), void* data, size_t stride, uint64_t count, Barrier* barrier, const uint32_t* nodes)
 {
-	size_t operator()(const czss::Guid& guid) const noexcept
+	State& s = state();
+	s.ensureStarted();
+
+	uint32_t self = State::current;
+	State::Queue& queue = self == State::NOT_A_WORKER ? s.shared : s.queues[self];
+	if (nodes == nullptr)
 	{
-		return std::hash<uint64_t>()(guid.get());
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		for (uint64_t i = 0; i < count; i++)
+			queue.push({ fn, reinterpret_cast<char*>(data) + i * stride, barrier });
 	}
-};
+	else
+	{
+		for (uint64_t i = 0; i < count; i++)
+		{
+			State::Queue* target = &queue;
+			if (nodes[i] < s.nodeWorkers.size() && !s.nodeWorkers[nodes[i]].empty())
+			{
+				auto& workers = s.nodeWorkers[nodes[i]];
+				target = &s.queues[workers[s.roundRobin.fetch_add(1) % workers.size()]];
+			}
 
-} // namespace std
+			std::lock_guard<std::mutex> lock(target->mutex);
+			target->push({ fn, reinterpret_cast<char*>(data) + i * stride, barrier });
+		}
+	}
 
-#endif // CZSS_HEADERS_H
+	s.pending.fetch_add(count, std::memory_order_acq_rel);
+	s.wake(count);
+}
 
-#ifdef CZSS_IMPLEMENTATION
+// Returns false if no worker could stand in for the caller
+bool ThreadPool::beginBlocking()
+{
+	State& s = state();
+	if (State::current == State::NOT_A_WORKER)
+		return true;
 
-#ifndef CZSS_IMPLEMENTATION_GUARD_
-#define CZSS_IMPLEMENTATION_GUARD_
+	s.blocked.fetch_add(1);
+	std::lock_guard<std::mutex> lock(s.mutex);
+	if (s.parked.load() > 0)
+	{
+		s.parkCv.notify_one();
+	}
+	else if (s.sleeping.load() > 0)
+	{
+		s.cv.notify_one();
+	}
+	else if (s.running() < s.target.load() && !s.stopping.load() && !s.spawn())
+	{
+		s.blocked.fetch_sub(1);
+		return false;
+	}
 
-namespace czss
+	return true;
+}
+
+void ThreadPool::endBlocking()
 {
+	if (State::current != State::NOT_A_WORKER)
+		state().blocked.fetch_sub(1);
+}
 
-Guid::Guid() { }
+void ThreadPool::Barrier::wait()
+{
+	// Signals count down under the mutex, so taking it before returning
+	// keeps the caller from destroying the barrier while a signal() is
+	// still inside it.
+	if (value.load(std::memory_order_acquire) <= 0)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return;
+	}
 
-Guid::Guid(uint64_t v) : id(v) { }
+	// Running other tasks here could nest a dependant of a task further
+	// down this stack, so the thread blocks and lends its slot instead.
+	// With MAX_WORKERS running there's no slot to lend, and the thread
+	// runs queued tasks until released rather than leave them unrun.
+	if (!beginBlocking())
+	{
+		CZSS_PERF_PAUSE();
+		State& s = state();
+		State::Task task;
+		while (value.load(std::memory_order_acquire) > 0)
+		{
+			if (s.take(State::current, task))
+				State::execute(task);
+			else
+				std::this_thread::yield();
+		}
 
-Guid::Guid(const Guid& other) : id(other.id) { }
+		std::lock_guard<std::mutex> lock(mutex);
+		return;
+	}
 
-uint64_t Guid::get() const
-{
-	return id;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		cv.wait(lock, [&] { return value.load(std::memory_order_acquire) <= 0; });
+	}
+	endBlocking();
 }
 
-bool Guid::operator ==(const Guid& other) const
+} // namespace czss
+
+#ifdef CZSS_ALLOC_COUNTERS
+// Replaced for AllocCounters. Every form allocates with malloc or
+// aligned_alloc so every form of delete can release with free, through
+// countedFree. Kept out of line, GCC otherwise sees free() paired with
+// operator new and warns.
+namespace czss
+{
+namespace
 {
-	return this->id == other.id;
-}
 
-bool Guid::operator !=(const Guid& other) const
+void* countedAlloc(size_t size, size_t alignment, bool nothrow)
 {
-	return this->id != other.id;
+	AllocCounters::count(size);
+	if (size == 0)
+		size = 1;
+
+	void* p;
+	if (alignment <= alignof(std::max_align_t))
+		p = malloc(size);
+	else
+		p = aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+
+	if (p == nullptr && !nothrow)
+		throw std::bad_alloc();
+	return p;
 }
 
-bool Guid::operator <(const Guid& other) const
+__attribute__((noinline)) void countedFree(void* p)
 {
-	return this->id < other.id;
+	free(p);
 }
 
-void TemplateStubs::setGuid(Guid guid) { }
-Guid TemplateStubs::getGuid() const { return Guid(0); }
-
+} // namespace
 } // namespace czss
 
+void* operator new(size_t size) { return czss::countedAlloc(size, 0, false); }
+void* operator new[](size_t size) { return czss::countedAlloc(size, 0, false); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return czss::countedAlloc(size, 0, true); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return czss::countedAlloc(size, 0, true); }
+void* operator new(size_t size, std::align_val_t alignment) { return czss::countedAlloc(size, size_t(alignment), false); }
+void* operator new[](size_t size, std::align_val_t alignment) { return czss::countedAlloc(size, size_t(alignment), false); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return czss::countedAlloc(size, size_t(alignment), true); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return czss::countedAlloc(size, size_t(alignment), true); }
+
+void operator delete(void* p) noexcept { czss::countedFree(p); }
+void operator delete[](void* p) noexcept { czss::countedFree(p); }
+void operator delete(void* p, size_t) noexcept { czss::countedFree(p); }
+void operator delete[](void* p, size_t) noexcept { czss::countedFree(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { czss::countedFree(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { czss::countedFree(p); }
+void operator delete(void* p, std::align_val_t) noexcept { czss::countedFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { czss::countedFree(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { czss::countedFree(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { czss::countedFree(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { czss::countedFree(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { czss::countedFree(p); }
+#endif
+
 #endif	// CZSS_IMPLEMENTATION_GUARD_
 
 #endif // CZSS_IMPLEMENTATION
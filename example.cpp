@@ -2,8 +2,10 @@
 #define CZSS_IMPLEMENTATION
 #include "czss.hpp"
 
+#ifndef CZSS_BACKEND_THREAD_POOL
 #define CZSF_IMPLEMENTATION
 #include <czsf.h>
+#endif
 
 #include <iostream>
 #include <chrono>
@@ -16,7 +18,6 @@ using namespace chrono;
 
 volatile static bool EXITING = false;
 static constexpr size_t N_PARALLEL = 4;
-static constexpr size_t CACHE_PADDING = 32;
 
 struct Resa : Resource<Resa>
 {
@@ -24,11 +25,13 @@ struct Resa : Resource<Resa>
 	uint64_t pointer = 0;
 	uint64_t iter = 0;
 	uint64_t iter2 = 0;
+	uint64_t batch = 0;
 
 	uint64_t parallel_ns = 0;
 	uint64_t pointer_ns = 0;
 	uint64_t iter_ns = 0;
 	uint64_t iter2_ns = 0;
+	uint64_t batch_ns = 0;
 };
 
 struct RemoveGuid : Resource<RemoveGuid>
@@ -112,15 +115,9 @@ void run_c(A_run_c& arch)
 	size_t parallel = ents / 8192;
 	if (parallel == 0) parallel = 1;
 #endif
-	std::vector<uint64_t> counters(parallel * CACHE_PADDING, 0);
-
-	arch.parallelIterate<Iter>(parallel, [&] (uint64_t index, auto& accessor)
-	{
-		counters[index * CACHE_PADDING] += accessor.template viewComponent<A>()->value;
-	});
-
-	for (int i = 0; i < parallel; i++)
-		res->parallel += counters[i * CACHE_PADDING];
+	res->parallel += arch.parallelReduce<Iter>(parallel, uint64_t(0),
+		[] (auto& accessor) { return uint64_t(accessor.template viewComponent<A>()->value); },
+		[] (uint64_t a, uint64_t b) { return a + b; });
 
 	auto b = high_resolution_clock::now();
 
@@ -143,10 +140,15 @@ void run_c(A_run_c& arch)
 
 	auto e = high_resolution_clock::now();
 
+	res->batch += arch.batchSum<Iter, &A::value>();
+
+	auto f = high_resolution_clock::now();
+
 	res->parallel_ns += duration_cast<nanoseconds>(b - a).count();
 	res->pointer_ns += duration_cast<nanoseconds>(c - b).count();
 	res->iter_ns += duration_cast<nanoseconds>(d - c).count();
 	res->iter2_ns += duration_cast<nanoseconds>(e - d).count();
+	res->batch_ns += duration_cast<nanoseconds>(f - e).count();
 };
 
 // struct V : czss::Component<V> {};
@@ -232,8 +234,9 @@ void fmain()
 	std::cout << "Results: "
 		<< "\n\t For-loop:              " << res.iter
 		<< "\n\t Lambda using pointers: " << res.pointer
-		<< "\n\t Typed lambda (iter2):  " << res.iter
+		<< "\n\t Typed lambda (iter2):  " << res.iter2
 		<< "\n\t Parallel lambda:       " << res.parallel
+		<< "\n\t SIMD batch sum:        " << res.batch
 		<< std::endl;
 
 	std::cout << "Timing: "
@@ -241,6 +244,7 @@ void fmain()
 		<< "\n\t Lambda using pointers: " << std::setw(13) << res.pointer_ns << "ns"
 		<< "\n\t Typed lambda (iter2):  " << std::setw(13) << res.iter2_ns << "ns"
 		<< "\n\t Parallel lambda:       " << std::setw(13) << res.parallel_ns << "ns"
+		<< "\n\t SIMD batch sum:        " << std::setw(13) << res.batch_ns << "ns (" << simd::isaName(simd::isa()) << ")"
 		<< std::endl;
 
 	EXITING = true;
@@ -248,7 +252,7 @@ void fmain()
 
 int main()
 {
-#ifdef CZSF_IMPL_THREADS
+#if defined(CZSF_IMPL_THREADS) || defined(CZSS_BACKEND_THREAD_POOL)
 	fmain();
 #else
 	czsf::run(fmain);
@@ -256,7 +260,7 @@ int main()
 	std::thread threads[N_PARALLEL];
 
 	for (int i = 0; i < N_PARALLEL; i++)
-		threads[i] = std::thread([] { while (!EXITING) { czsf_yield(); } });
+		threads[i] = std::thread([] { CzsfBackend::work(EXITING); });
 
 	for (int i = 0; i < N_PARALLEL; i++)
 		threads[i].join();
@@ -0,0 +1,87 @@
+// Regression tests of the thread pool's worker handoff, exits nonzero on
+// failure:
+//
+//     clang++ -O1 pool_test.cpp -pthread
+//
+// A task waiting on a task it submitted makes the pool start a worker in
+// its place, which parks once the wait is over. A later single task must
+// still wake a sleeping worker rather than the parked one.
+
+#define CZSS_BACKEND_THREAD_POOL
+#define CZSS_IMPLEMENTATION
+#include "czss.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+using namespace czss;
+
+static constexpr int ITERATIONS = 20;
+static constexpr std::chrono::seconds TIMEOUT(10);
+
+struct Task
+{
+	std::atomic<int>* count;
+};
+
+static void inner(Task* task)
+{
+	(*task->count)++;
+}
+
+// Waits on an inner task, a worker is started to stand in while it does
+static void outer(Task* task)
+{
+	ThreadPool::Barrier barrier(1);
+	Task innerTask = { task->count };
+	ThreadPool::run(inner, &innerTask, 1, &barrier);
+	barrier.wait();
+	(*task->count)++;
+}
+
+static void fail(const char* what)
+{
+	fprintf(stderr, "FAIL: %s\n", what);
+	std::_Exit(1);
+}
+
+int main()
+{
+	std::thread([] {
+		std::this_thread::sleep_for(TIMEOUT);
+		fail("timed out, a submitted task never ran");
+	}).detach();
+
+	ThreadPool::start(1);
+
+	std::atomic<int> count { 0 };
+	Task task = { &count };
+	ThreadPool::Barrier barrier(1);
+	ThreadPool::run(outer, &task, 1, &barrier);
+	barrier.wait();
+	if (count != 2)
+		fail("nested wait");
+	if (ThreadPool::workerCount() < 2)
+		fail("no worker stood in for the blocked one");
+
+	// Let the standing in worker park and the other fall asleep
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+	for (int i = 0; i < ITERATIONS; i++)
+	{
+		std::atomic<int> single { 0 };
+		Task singleTask = { &single };
+		ThreadPool::Barrier done(1);
+		ThreadPool::run(inner, &singleTask, 1, &done);
+		done.wait();
+		if (single != 1)
+			fail("single task");
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+
+	printf("pool_test: %d single submits after a nested wait, %u workers\n", ITERATIONS, ThreadPool::workerCount());
+	ThreadPool::stop();
+}
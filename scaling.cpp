@@ -0,0 +1,276 @@
+// Runs a frame of several systems over a world of particles at each worker
+// count and reports throughput, speedup, parallel efficiency and frame
+// latency percentiles as JSON. Build it once per backend to compare them:
+//
+//     clang++ -O2 scaling.cpp                                   czsf fibers
+//     clang++ -O2 -DCZSF_IMPL_THREADS scaling.cpp               czsf threads
+//     clang++ -O2 -DCZSS_BACKEND_THREAD_POOL scaling.cpp -pthread
+//
+//     scaling [--entities N] [--frames N] [--max-threads N] [--out FILE]
+//
+// Parallel systems split their work like example.cpp does: into one task
+// per worker under CZSF_IMPL_THREADS, where czsf starts a thread per task,
+// and into tasks of 8192 entities otherwise. Under CZSF_IMPL_THREADS the
+// worker count is therefore the number of tasks.
+//
+// p999 takes at least 10000 frames to be more than the slowest frame, so
+// with fewer it's written as null; max is always written.
+
+// #define CZSF_IMPL_THREADS
+#define CZSS_IMPLEMENTATION
+#include "czss.hpp"
+
+#ifndef CZSS_BACKEND_THREAD_POOL
+#define CZSF_IMPLEMENTATION
+#include <czsf.h>
+#endif
+
+#include "bench_harness.hpp"
+
+#include <deque>
+#include <memory>
+
+using namespace czss;
+using bench::currentThreads;
+
+struct Position : Component<Position>
+{
+	float x, y, z;
+};
+
+struct Velocity : Component<Velocity>
+{
+	float x, y, z;
+};
+
+struct Health : Component<Health>
+{
+	float value;
+};
+
+struct Particle : Entity<Position, Velocity, Health> {};
+struct Marker : Entity<Position> {};
+
+struct Spawned : Resource<Spawned>
+{
+	std::deque<Guid> guids;
+	uint64_t perFrame = 0;
+};
+
+struct Totals : Resource<Totals>
+{
+	float energy = 0;
+	uint64_t alive = 0;
+};
+
+struct ScaleArch : Architecture<
+	ScaleArch,
+	Spawned,
+	Totals,
+	Particle,
+	Marker
+> {};
+
+static Guid spawn(Particle* p, float x, float y)
+{
+	Position* position = p->getComponent<Position>();
+	position->x = x;
+	position->y = y;
+	position->z = 0.0f;
+
+	Velocity* velocity = p->getComponent<Velocity>();
+	velocity->x = 1.0f;
+	velocity->y = 0.5f;
+	velocity->z = 0.25f;
+
+	p->getComponent<Health>()->value = 100.0f;
+	return p->getGuid();
+}
+
+static uint64_t numTasks(uint64_t entities)
+{
+#ifdef CZSF_IMPL_THREADS
+	return currentThreads;
+#else
+	return std::max(entities / 8192, uint64_t(1));
+#endif
+}
+
+// Replaces the oldest particles with new ones
+struct Lifetime : System<Orchestrator<Particle>, Writer<Spawned>>
+{
+	static void run(Accessor<ScaleArch, Lifetime>& arch)
+	{
+		Spawned* spawned = arch.getResource<Spawned>();
+		for (uint64_t i = 0; i < spawned->perFrame && !spawned->guids.empty(); i++)
+		{
+			arch.destroyEntity(spawned->guids.front());
+			spawned->guids.pop_front();
+
+			spawned->guids.push_back(spawn(arch.createEntity<Particle>(), 0.0f, 0.0f));
+		}
+	}
+};
+
+struct Integrate : System<Writer<Position>, Reader<Velocity>, Dependency<Lifetime>>
+{
+	static void run(Accessor<ScaleArch, Integrate>& arch)
+	{
+		arch.parallelIterate<Iterator<Position, Velocity>>(numTasks(arch.countCompatibleEntities<Iterator<Position, Velocity>>()),
+			[] (uint64_t, auto& e) {
+				Position* p = e.template getComponent<Position>();
+				const Velocity* v = e.template viewComponent<Velocity>();
+				p->x += v->x * 0.016f;
+				p->y += v->y * 0.016f;
+				p->z += v->z * 0.016f;
+			});
+	}
+};
+
+struct Decay : System<Writer<Health>, Dependency<Lifetime>>
+{
+	static void run(Accessor<ScaleArch, Decay>& arch)
+	{
+		arch.parallelIterate<Iterator<Health>>(numTasks(arch.countCompatibleEntities<Iterator<Health>>()),
+			[] (uint64_t, auto& e) {
+				Health* h = e.template getComponent<Health>();
+				h->value = h->value > 1.0f ? h->value * 0.999f : 100.0f;
+			});
+	}
+};
+
+struct Measure : System<Reader<Position, Health>, Writer<Totals>, Dependency<Integrate, Decay>>
+{
+	static void run(Accessor<ScaleArch, Measure>& arch)
+	{
+		uint64_t n = arch.countCompatibleEntities<Iterator<Position>>();
+		arch.getResource<Totals>()->energy = arch.parallelReduce<Iterator<Position>>(numTasks(n), 0.0f,
+			[] (auto& e) { const Position* p = e.template viewComponent<Position>(); return p->x + p->y + p->z; },
+			[] (float a, float b) { return a + b; });
+		arch.getResource<Totals>()->alive = n;
+	}
+};
+
+using ScaleRunner = Runner<ScaleArch, std::tuple<Lifetime, Integrate, Decay, Measure>>;
+
+struct Options
+{
+	uint64_t entities = 1000000;
+	uint64_t frames = 1000;
+	uint32_t maxThreads = 0;
+	const char* out = nullptr;
+};
+
+struct Result
+{
+	uint32_t threads;
+	double seconds;
+	double p50, p99, p999, max;
+};
+
+// Fewest frames for which p999 isn't the slowest frame
+static constexpr uint64_t P999_FRAMES = 10000;
+
+static Options options;
+static std::vector<Result> results;
+
+static double percentile(const std::vector<uint64_t>& sorted, double p)
+{
+	size_t i = std::min(sorted.size() - 1, size_t(p * sorted.size()));
+	return sorted[i] / 1e6;
+}
+
+static void scale()
+{
+	auto arch = std::make_unique<ScaleArch>();
+	Spawned spawned;
+	Totals totals;
+	arch->setResource(&spawned);
+	arch->setResource(&totals);
+
+	auto accessor = arch->accessor();
+	for (uint64_t i = 0; i < options.entities; i++)
+	{
+		spawned.guids.push_back(spawn(accessor.createEntity<Particle>(), float(i % 1000), float(i / 1000)));
+
+		if (i % 4 == 0)
+			accessor.createEntity<Marker>();
+	}
+	spawned.perFrame = std::max(options.entities / 1000, uint64_t(1));
+
+	ScaleRunner::FrameClock clock;
+	for (int i = 0; i < 20; i++)
+		ScaleRunner::runFrame(arch.get(), &clock, 0.016);
+
+	std::vector<uint64_t> frames(options.frames);
+	uint64_t start = nanoTime();
+	for (uint64_t& frame : frames)
+	{
+		uint64_t begin = nanoTime();
+		ScaleRunner::runFrame(arch.get(), &clock, 0.016);
+		frame = nanoTime() - begin;
+	}
+	uint64_t total = nanoTime() - start;
+
+	std::sort(frames.begin(), frames.end());
+	Result r;
+	r.threads = currentThreads;
+	r.seconds = total / 1e9;
+	r.p50 = percentile(frames, 0.5);
+	r.p99 = percentile(frames, 0.99);
+	r.p999 = percentile(frames, 0.999);
+	r.max = frames.back() / 1e6;
+	results.push_back(r);
+
+	fprintf(stderr, "threads %3u  %10.1f frames/s  p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms\n",
+		r.threads, options.frames / r.seconds, r.p50, r.p99, r.max);
+}
+
+int main(int argc, char** argv)
+{
+	bool parsed = bench::parseOptions(argc, argv, [] (const char* name, const char* value) {
+		if (strcmp(name, "--entities") == 0)
+			options.entities = uint64_t(atof(value));
+		else if (strcmp(name, "--frames") == 0)
+			options.frames = uint64_t(atof(value));
+		else if (strcmp(name, "--max-threads") == 0)
+			options.maxThreads = uint32_t(atoi(value));
+		else if (strcmp(name, "--out") == 0)
+			options.out = value;
+		else
+			return false;
+		return true;
+	});
+	if (!parsed)
+		return 1;
+
+	if (options.frames == 0)
+		options.frames = 1;
+	if (options.maxThreads == 0)
+		options.maxThreads = bench::defaultThreads();
+
+	bench::runScaling(options.maxThreads, scale);
+
+	// Speedup and efficiency are relative to the first worker count run.
+	double base = options.frames / results.front().seconds;
+	bool written = bench::writeJson(options.out, results.size(),
+		[] (FILE* f) {
+			fprintf(f, "\t\"entities\": %llu,\n\t\"frames\": %llu,\n",
+				static_cast<unsigned long long>(options.entities), static_cast<unsigned long long>(options.frames));
+		},
+		[base] (FILE* f, size_t i) {
+			const Result& r = results[i];
+			double fps = options.frames / r.seconds;
+			double speedup = fps / base;
+			fprintf(f, "\"threads\": %u, \"frames_per_second\": %.2f, \"entity_updates_per_second\": %.0f, "
+				"\"speedup\": %.3f, \"efficiency\": %.3f, \"p50_ms\": %.3f, \"p99_ms\": %.3f, ",
+				r.threads, fps, fps * options.entities, speedup, speedup * results.front().threads / r.threads,
+				r.p50, r.p99);
+			if (options.frames >= P999_FRAMES)
+				fprintf(f, "\"p999_ms\": %.3f, ", r.p999);
+			else
+				fprintf(f, "\"p999_ms\": null, ");
+			fprintf(f, "\"max_ms\": %.3f", r.max);
+		});
+	return written ? 0 : 1;
+}